@@ -11,6 +11,7 @@
 #include <sys/select.h>
 #include <sys/signalfd.h>
 #include <sys/sysinfo.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
@@ -52,6 +53,10 @@ typedef struct core
 	volatile uint32_t intr_pending;
 	interrupt_handler* intvec[maximum_interrupt_no];
 
+	/* The serial ports that raised SERIAL_RX_READY and SERIAL_TX_READY, 
+	   indexed by io_direction, one bit per port */
+	volatile uint32_t serial_pending[2];
+
 
 #if defined(CORE_STATISTICS)
 	/* Statistics */
@@ -180,6 +185,7 @@ static void* core_thread(void* _core)
 
 	/* Clear pending bitvec */
 	core->intr_pending = 0;
+	core->serial_pending[0] = core->serial_pending[1] = 0;
 
 	/* Default interrupt handlers */
 	for(int i=0; i<maximum_interrupt_no; i++) 
@@ -410,6 +416,7 @@ typedef struct io_device
 {
 	int fd;              		/* file descriptor */
 	io_direction iodir;  		/* device direction */
+	uint serial;				/* the serial port of the device */
 
 	Core* volatile int_core;	/* core to receive interrupts */
 	volatile int ready;  		/* ready flag */
@@ -449,10 +456,11 @@ static int io_device_check(io_device* dev)
 /*
 	Initialize device
  */
-static void io_device_init(io_device* this, int fd, io_direction iodir)
+static void io_device_init(io_device* this, int fd, io_direction iodir, uint serial)
 {
 	this->fd = fd;
 	this->iodir = iodir;
+	this->serial = serial;
 	this->int_core = &CORE[0];
 	this->ready = io_device_ready(fd, iodir);
 	this->last_int = get_coarse_time();
@@ -473,42 +481,46 @@ static int io_device_destroy(io_device* this)
 }
 
 
-static int io_device_read(io_device* this, char* ptr)
+/*
+	Transfer up to n bytes, with one host call. Return the number of bytes
+	transferred. The device is made not-ready only if nothing was transferred.
+ */
+static unsigned int io_device_read(io_device* this, char* ptr, unsigned int n)
 {
 	assert(this->iodir == IODIR_RX);
-	int rc;
-	while((rc=read(this->fd, ptr, 1))==-1 && errno == EINTR);
+	ssize_t rc;
+	while((rc=read(this->fd, ptr, n))==-1 && errno == EINTR);
 
-	int ok = rc==0 || rc==1 || (rc==-1 && (errno==EAGAIN || errno==EWOULDBLOCK));
+	int ok = rc>=0 || (rc==-1 && (errno==EAGAIN || errno==EWOULDBLOCK));
 	if(!ok) perror("io_device_read:");
 	assert(ok);
 
-	if(rc!=1 && this->ready) {
+	if(rc<=0 && this->ready) {
 		this->ready = 0;
 		interrupt_pic_thread();
 	}
-	return rc==1;
+	return rc>0 ? rc : 0;
 }
 
 
-static int io_device_write(io_device* this, char value)
+static unsigned int io_device_write(io_device* this, const char* ptr, unsigned int n)
 {
 	assert(this->iodir == IODIR_TX);
 
 	/* Try to write */
-	int rc;
-	while((rc = write(this->fd, &value, 1))==-1 && errno == EINTR);
+	ssize_t rc;
+	while((rc = write(this->fd, ptr, n))==-1 && errno == EINTR);
 
-	int ok = rc==1 || (rc==-1 && (errno == EAGAIN || errno==EWOULDBLOCK || errno == EPIPE));
+	int ok = rc>0 || (rc==-1 && (errno == EAGAIN || errno==EWOULDBLOCK || errno == EPIPE));
 	if(! ok) perror("io_device_write:");
 	assert(ok);
 
-	if(rc!=1 && this->ready) {
+	if(rc<=0 && this->ready) {
 		this->ready = 0;
 		interrupt_pic_thread();
 	} 
 
-	return rc==1;
+	return rc>0 ? rc : 0;
 }
 
 
@@ -532,10 +544,10 @@ static uint nterm = 0;
 /*
 	Init the devices for this terminal
  */
-static void terminal_init(terminal* this, int fdin, int fdout)
+static void terminal_init(terminal* this, uint serial, int fdin, int fdout)
 {
-	io_device_init(& this->kbd, fdin, IODIR_RX);
-	io_device_init(& this->con, fdout, IODIR_TX);
+	io_device_init(& this->kbd, fdin, IODIR_RX, serial);
+	io_device_init(& this->con, fdout, IODIR_TX, serial);
 }
 
 /*
@@ -551,6 +563,134 @@ static int terminal_destroy(terminal* this)
 
 
 
+/*
+	A disk is a host file, accessed by a worker thread.
+
+	Submitted requests are appended to a FIFO queue. The worker thread
+	executes them one by one, using preadv/pwritev, pushes each completed 
+	request to a lock-free stack and raises DISK_READY.
+ */
+typedef struct disk
+{
+	int fd;							/* the host file */
+	uint64_t nsectors;				/* the size of the disk */
+	pthread_t worker;				/* the worker thread */
+
+	pthread_mutex_t mx;				/* protects the following */
+	pthread_cond_t cv;				/* the worker waits here */
+	disk_request *qhead, *qtail;	/* the request queue */
+	int active;						/* cleared at shutdown */
+
+	disk_request* completed;		/* stack of completed requests */
+	Core* volatile int_core;		/* core to receive interrupts */
+} disk;
+
+/* The disk table */
+static disk DISK[MAX_DISKS];
+
+/* Current number of disks */
+static uint ndisks = 0;
+
+
+static void disk_execute(disk* this, disk_request* req)
+{
+	struct iovec iov[DISK_MAX_SEGMENTS];
+	size_t total = 0;
+	for(uint i=0; i<req->nseg; i++) {
+		iov[i].iov_base = req->seg[i].buf;
+		iov[i].iov_len = req->seg[i].nsectors * DISK_SECTOR_SIZE;
+		total += iov[i].iov_len;
+	}
+
+	off_t off = req->sector * DISK_SECTOR_SIZE;
+	ssize_t rc;
+	if(req->op == DISK_OP_READ)
+		while((rc = preadv(this->fd, iov, req->nseg, off))==-1 && errno==EINTR);
+	else
+		while((rc = pwritev(this->fd, iov, req->nseg, off))==-1 && errno==EINTR);
+
+	if(rc==-1) perror("disk_execute: ");
+	req->status = (rc == total) ? 0 : -1;
+}
+
+
+static void* disk_worker(void* _disk)
+{
+	disk* this = (disk*) _disk;
+
+	CHECKRC(pthread_mutex_lock(& this->mx));
+	while(1) {
+		while(this->qhead == NULL && this->active)
+			CHECKRC(pthread_cond_wait(& this->cv, & this->mx));
+		if(this->qhead == NULL) break;
+
+		disk_request* req = this->qhead;
+		this->qhead = req->next;
+		if(this->qhead == NULL) this->qtail = NULL;
+
+		CHECKRC(pthread_mutex_unlock(& this->mx));
+		disk_execute(this, req);
+
+		/* Push to the completed stack */
+		req->next = __atomic_load_n(& this->completed, __ATOMIC_RELAXED);
+		while(! __atomic_compare_exchange_n(& this->completed, & req->next, req, 0,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+		raise_interrupt((Core*) this->int_core, DISK_READY);
+		CHECKRC(pthread_mutex_lock(& this->mx));
+	}
+	CHECKRC(pthread_mutex_unlock(& this->mx));
+	return NULL;
+}
+
+
+static void disk_init(disk* this, uint id, int fd)
+{
+	struct stat st;
+	CHECK(fstat(fd, &st));
+
+	this->fd = fd;
+	this->nsectors = st.st_size / DISK_SECTOR_SIZE;
+	CHECKRC(pthread_mutex_init(& this->mx, NULL));
+	CHECKRC(pthread_cond_init(& this->cv, NULL));
+	this->qhead = this->qtail = NULL;
+	this->active = 1;
+	this->completed = NULL;
+	this->int_core = &CORE[0];
+
+	/* The worker must not receive any signals (e.g. the core timers' SIGALRM) */
+	sigset_t allsigs, saved;
+	CHECK(sigfillset(&allsigs));
+	CHECKRC(pthread_sigmask(SIG_BLOCK, &allsigs, &saved));
+	CHECKRC(pthread_create(& this->worker, NULL, disk_worker, this));
+	CHECKRC(pthread_sigmask(SIG_SETMASK, &saved, NULL));
+
+	char thread_name[16];
+	CHECK(snprintf(thread_name,16,"disk-%u",id));
+	CHECKRC(pthread_setname_np(this->worker, thread_name));
+}
+
+
+static int disk_destroy(disk* this)
+{
+	CHECKRC(pthread_mutex_lock(& this->mx));
+	this->active = 0;
+	CHECKRC(pthread_cond_signal(& this->cv));
+	CHECKRC(pthread_mutex_unlock(& this->mx));
+	CHECKRC(pthread_join(this->worker, NULL));
+
+	CHECKRC(pthread_mutex_destroy(& this->mx));
+	CHECKRC(pthread_cond_destroy(& this->cv));
+
+	int rc;
+	while((rc = close(this->fd))==-1 && errno==EINTR);
+	if(rc==-1) perror("disk_destroy: ");
+	return rc;
+}
+
+
+
+
 /*
 	The PIC daemon dispatches interrupts to core threads,
 	by calling raise_interrupt().
@@ -560,6 +700,8 @@ static int terminal_destroy(terminal* this)
 	(b) SERIAL_RX_READY  &  SERIAL_TX_READY, when some 
 		io_device becomes ready.
 
+	DISK_READY interrupts are raised directly by the disk workers.
+
 	Implementation:
 	- Use Linux signal file descriptors to receive signals. Currently,
 	  two signals are used:
@@ -700,6 +842,9 @@ static void term_dev_raise_if_ready(io_device* dev, pic_selector* ps)
 		dev->ready = 1;
 		dev->last_int = ps->system_clock;
 		Core* core = (Core*) dev->int_core;
+
+		/* Mark the port as pending, before the interrupt is raised */
+		__atomic_fetch_or(& core->serial_pending[dev->iodir], 1u << dev->serial, __ATOMIC_RELEASE);
 		switch(dev->iodir) {
 			case IODIR_RX:
 				raise_interrupt(core, SERIAL_RX_READY); break;
@@ -850,11 +995,27 @@ int vm_config_terminals(vm_config* vmc, uint serialno, int nowait)
 }
 
 
+uint vm_config_disks(vm_config* vmc)
+{
+	vmc->diskno = 0;
+	for(uint i=0; i<MAX_DISKS; i++) {
+		char fname[16];
+		snprintf(fname,16,"disk%u", i);
+
+		int fd = open(fname, O_RDWR);
+		if(fd==-1) break;
+		vmc->disk_fd[vmc->diskno++] = fd;
+	}
+	return vmc->diskno;
+}
+
+
 void vm_configure(vm_config* vmc, interrupt_handler bootfunc, uint cores, uint serialno)
 {
 	vmc->bootfunc = bootfunc;
 	vmc->cores = cores;
 	CHECK(vm_config_terminals(vmc, serialno, 0));
+	vm_config_disks(vmc);
 }
 
 
@@ -874,6 +1035,7 @@ void vm_run(vm_config* vmc)
 	CHECK_CONDITION(vmc->cores > 0 && vmc->cores <= MAX_CORES);
 	CHECK_CONDITION(ncores==0);
 	CHECK_CONDITION(vmc->serialno <= MAX_TERMINALS);
+	CHECK_CONDITION(vmc->diskno <= MAX_DISKS);
 
 	/* This is called only once in the life of the process. */
 	CHECKRC(pthread_once(&init_control, initialize));
@@ -888,7 +1050,12 @@ void vm_run(vm_config* vmc)
 	/* Initialize terminals */
 	nterm = vmc->serialno;
 	for(uint i=0; i<nterm; i++)
-		terminal_init(& TERM[i], vmc->serial_in[i], vmc->serial_out[i]);
+		terminal_init(& TERM[i], i, vmc->serial_in[i], vmc->serial_out[i]);
+
+	/* Initialize disks */
+	ndisks = vmc->diskno;
+	for(uint i=0; i<ndisks; i++)
+		disk_init(& DISK[i], i, vmc->disk_fd[i]);
 
 	/* Init the cores */
 	ncores = vmc->cores;
@@ -942,6 +1109,12 @@ void vm_run(vm_config* vmc)
 #endif
 	}
 
+	/* Finalize disks. This must happen while the Core table is valid,
+	   since a worker may still raise an interrupt. */
+	for(uint i=0; i<ndisks; i++)
+		CHECK(disk_destroy(& DISK[i]));
+	ndisks = 0;
+
 	/* Delete the Core table */
 	ncores = 0;
 
@@ -1175,6 +1348,14 @@ TimerDuration bios_clock()
 }	
 
 
+uint64_t bios_clock_ns()
+{
+	struct timespec curtime;
+	CHECK(clock_gettime(CLOCK_MONOTONIC, &curtime));
+	return curtime.tv_nsec + curtime.tv_sec*1000000000ull;
+}
+
+
 
 uint bios_serial_ports()
 {
@@ -1201,13 +1382,42 @@ void bios_serial_interrupt_core(uint serial, Interrupt intno, uint coreid)
 }
 
 
+/*
+	Return and clear the set of serial ports that raised 'intno' to the 
+	current core.
+ */
+uint32_t bios_serial_pending(Interrupt intno)
+{
+	Core* core = curr_core();
+	switch(intno) {
+		case SERIAL_RX_READY:
+			return __atomic_exchange_n(& core->serial_pending[IODIR_RX], 0, __ATOMIC_ACQUIRE);
+		case SERIAL_TX_READY:
+			return __atomic_exchange_n(& core->serial_pending[IODIR_TX], 0, __ATOMIC_ACQUIRE);
+		default:
+			return 0;
+	}
+}
+
+
 /*
 	Try to read a byte from serial port 'serial' and store it into the location
 	pointed by 'ptr'.  If the operation succeds, 1 is returned. If not, 0 is returned.
  */
 int bios_read_serial(uint serial, char* ptr)
 {
-	return io_device_read(& TERM[serial].kbd, ptr);
+	return io_device_read(& TERM[serial].kbd, ptr, 1);
+}
+
+
+/*
+	Read up to 'n' bytes from serial port 'serial' into 'buf', with one
+	host call. Return the number of bytes read.
+ */
+unsigned int bios_read_serial_buf(uint serial, char* buf, unsigned int n)
+{
+	if(n == 0) return 0;
+	return io_device_read(& TERM[serial].kbd, buf, n);
 }
 
 
@@ -1217,7 +1427,69 @@ int bios_read_serial(uint serial, char* ptr)
  */
 int bios_write_serial(uint serial, char value)
 {
-	return io_device_write(& TERM[serial].con, value);
+	return io_device_write(& TERM[serial].con, &value, 1);
 }
 
 
+/*
+	Write up to 'n' bytes from 'buf' to serial port 'serial', with one
+	host call. Return the number of bytes written.
+ */
+unsigned int bios_write_serial_buf(uint serial, const char* buf, unsigned int n)
+{
+	if(n == 0) return 0;
+	return io_device_write(& TERM[serial].con, buf, n);
+}
+
+
+uint bios_disks()
+{
+	return ndisks;
+}
+
+
+uint64_t bios_disk_sectors(uint d)
+{
+	return (d < ndisks) ? DISK[d].nsectors : 0;
+}
+
+
+int bios_disk_submit(uint d, disk_request* req)
+{
+	if(!(d < ndisks)) return -1;
+	disk* this = & DISK[d];
+
+	/* Check the request */
+	if(req->nseg == 0 || req->nseg > DISK_MAX_SEGMENTS) return -1;
+	uint64_t nsectors = 0;
+	for(uint i=0; i<req->nseg; i++)
+		nsectors += req->seg[i].nsectors;
+	if(req->sector + nsectors > this->nsectors || req->sector + nsectors < req->sector)
+		return -1;
+
+	req->next = NULL;
+	CHECKRC(pthread_mutex_lock(& this->mx));
+	if(this->qtail) 
+		this->qtail->next = req;
+	else 
+		this->qhead = req;
+	this->qtail = req;
+	CHECKRC(pthread_cond_signal(& this->cv));
+	CHECKRC(pthread_mutex_unlock(& this->mx));
+	return 0;
+}
+
+
+disk_request* bios_disk_completed(uint d)
+{
+	if(!(d < ndisks)) return NULL;
+	return __atomic_exchange_n(& DISK[d].completed, NULL, __ATOMIC_ACQUIRE);
+}
+
+
+void bios_disk_interrupt_core(uint d, uint coreid)
+{
+	if(!(d < ndisks)) return;
+	if(!(coreid < ncores)) return;
+	DISK[d].int_core = & CORE[coreid];
+}
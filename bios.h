@@ -98,6 +98,21 @@
 	Also, each interrupt is sent if the serial device timeouts (is inactive for
 	about 300 msec).
 
+	Disks
+	-----
+
+	The virtual machine has a number of disks, each one backed by a host file.
+	A disk is an array of sectors of size @c DISK_SECTOR_SIZE. Disks are 
+	numbered from 0 up to @c MAX_DISKS-1. By default, the files named 
+	disk@f$ N @f$ in the current directory are used as disks, if they exist.
+
+	Disk I/O is asynchronous, in the style of DMA. A @c disk_request, which
+	describes a transfer between a range of sectors and a list of memory 
+	segments, is submitted to the disk. The request is executed 
+	by the disk in the background, in submission order. When it is complete,
+	it is added to the disk's list of completed requests, and a @c DISK_READY
+	interrupt is raised.
+
  */
 
 
@@ -123,6 +138,7 @@ typedef enum Interrupt
 						   from a serial port */
 	SERIAL_TX_READY,	/**< Raised when a serial port is ready to accept 
 						   data */
+	DISK_READY,			/**< Raised when a disk request is complete */
 
 	maximum_interrupt_no 
 } Interrupt;
@@ -134,6 +150,15 @@ typedef enum Interrupt
 /** @brief Maximum number of terminals for a virtual machine. */
 #define MAX_TERMINALS 4
 
+/** @brief Maximum number of disks for a virtual machine. */
+#define MAX_DISKS 4
+
+/** @brief The size of a disk sector in bytes. */
+#define DISK_SECTOR_SIZE 512
+
+/** @brief Maximum number of memory segments of a disk request. */
+#define DISK_MAX_SEGMENTS 16
+
 
 
 /**
@@ -198,6 +223,20 @@ typedef struct vm_config {
 		must be valid in this structure.
 	*/
 	int serial_out[MAX_TERMINALS];
+
+	/** @brief The number of disks of the VM.
+
+		The number of disks should be between 0 and @c MAX_DISKS.
+	 */
+	uint diskno;
+
+	/** @brief The array of file descriptors for disks.
+
+		Each file descriptor must refer to a regular file, open for 
+		reading and writing. The size of the disk is the size of the file,
+		rounded down to a multiple of @c DISK_SECTOR_SIZE.
+	 */
+	int disk_fd[MAX_DISKS];
 } vm_config;
 
 
@@ -222,13 +261,27 @@ typedef struct vm_config {
 int vm_config_terminals(vm_config* vmc, uint serialno, int nowait);
 
 
+/**
+	@brief Initialize a VM configuration's disks from files.
+
+	The files named disk0, disk1, ... (up to @c MAX_DISKS) in the current 
+	directory are opened, stopping at the first one that does not exist.
+	Any disks already configured in @c vmc are replaced.
+
+	@param vmc the configuration to initialize
+	@return the number of disks configured
+*/
+uint vm_config_disks(vm_config* vmc);
+
+
 /**
 	@brief Initialize a VM configuration with passed parameters.
 
 	Prepare a VM configuration with the given parameters.
 	This is a convenience function to initialize the VM configuration
 	with serial devices using the terminal emulator program provided 
-	in the distribution of @c TinyOS.
+	in the distribution of @c TinyOS, and with disks by
+	@c vm_config_disks.
 
 	Note that this function will block until the terminal emulators
 	are executed.
@@ -484,6 +537,16 @@ TimerDuration bios_cancel_timer();
 TimerDuration bios_clock();
 
 
+/**
+	@brief Get the current time from a high-resolution clock.
+
+	This function returns the value of a monotonic clock, in nanoseconds.
+	Unlike @c bios_clock, it is cheap and precise enough to time short
+	intervals, such as the duration of a blocking wait.
+ */
+uint64_t bios_clock_ns();
+
+
 
 
 /**
@@ -512,6 +575,25 @@ uint bios_serial_ports();
 void bios_serial_interrupt_core(uint serial, Interrupt intno, uint core);
 
 
+/**
+	@brief Return the serial ports that raised an interrupt.
+
+	Each time a serial port raises @c SERIAL_RX_READY or @c SERIAL_TX_READY
+	to a core, it is added to a pending set of the core for this interrupt.
+	This call returns and clears the pending set of the current core, as a 
+	bit mask where bit @c i stands for serial port @c i.
+
+	A port is added to the set before the interrupt is raised, so the handler
+	of the interrupt finds it by calling this function. Because of this, a handler
+	may also collect ports whose interrupt is still pending, and the handler of that
+	interrupt will then find an empty set.
+
+	@param intno the interrupt (one of @c SERIAL_RX_READY and @c SERIAL_TX_READY)
+	@returns the set of ports, or 0 if @c intno is not a serial interrupt
+ */
+uint32_t bios_serial_pending(Interrupt intno);
+
+
 /**
 	@brief Read a byte from a serial port.
 
@@ -530,6 +612,24 @@ void bios_serial_interrupt_core(uint serial, Interrupt intno, uint core);
 int bios_read_serial(uint serial, char* ptr);
 
 
+/**
+	@brief Read a number of bytes from a serial port.
+
+	This is like @c bios_read_serial, but it transfers up to @c n bytes at once,
+	as many as the terminal has sent. It costs about as much as reading a single byte.
+
+	If this operation returns 0 (for @c n>0), a @c SERIAL_RX_READY interrupt will be raised 
+	when data is ready to be received. If it returns less than @c n, the next call 
+	will probably return 0.
+
+	@param serial the serial device to read from
+	@param buf the buffer to store the bytes read
+	@param n the size of the buffer
+	@return the number of bytes read
+ */
+unsigned int bios_read_serial_buf(uint serial, char* buf, unsigned int n);
+
+
 /**
 	@brief Write a byte to a serial port.
 
@@ -546,4 +646,101 @@ int bios_read_serial(uint serial, char* ptr);
 int bios_write_serial(uint serial, char value);
 
 
+/**
+	@brief Write a number of bytes to a serial port.
+
+	This is like @c bios_write_serial, but it transfers up to @c n bytes at once,
+	as many as the device can accept. It costs about as much as writing a single byte.
+
+	If this operation returns 0 (for @c n>0), a @c SERIAL_TX_READY interrupt will be raised 
+	when the device is ready to accept data.
+
+	@param serial the serial device to write to
+	@param buf the bytes to write
+	@param n the number of bytes to write
+	@return the number of bytes written
+ */
+unsigned int bios_write_serial_buf(uint serial, const char* buf, unsigned int n);
+
+
+/**
+	@brief The direction of a disk transfer.
+ */
+typedef enum disk_op {
+	DISK_OP_READ,		/**< Transfer from the disk to memory */
+	DISK_OP_WRITE		/**< Transfer from memory to the disk */
+} disk_op;
+
+/**
+	@brief A memory segment of a disk request.
+ */
+typedef struct disk_segment {
+	void* buf;			/**< @brief The memory of the segment */
+	uint nsectors;		/**< @brief The size of the segment in sectors */
+} disk_segment;
+
+/**
+	@brief A disk request.
+
+	The request transfers the sectors starting at @c sector to (or from)
+	the memory segments @c seg[0], ..., @c seg[nseg-1], in that order.
+
+	The request is owned by the disk from submission until it is returned
+	by @c bios_disk_completed.
+ */
+typedef struct disk_request {
+	disk_op op;			/**< @brief The direction of the transfer */
+	uint64_t sector;	/**< @brief The first sector of the transfer */
+	uint nseg;			/**< @brief The number of memory segments */
+	disk_segment seg[DISK_MAX_SEGMENTS];	/**< @brief The memory segments */
+
+	int status;			/**< @brief Set at completion: 0 on success, -1 on I/O error */
+	struct disk_request* next;	/**< @brief Used by the disk */
+} disk_request;
+
+
+/**
+	@brief Return the number of disks.
+ */
+uint bios_disks();
+
+/**
+	@brief Return the number of sectors of a disk, or 0 if @c disk is illegal.
+ */
+uint64_t bios_disk_sectors(uint disk);
+
+/**
+	@brief Submit a request to a disk.
+
+	The request is queued to the disk, and the call returns immediately.
+	Upon completion, a @c DISK_READY interrupt is raised.
+
+	@param disk the disk
+	@param req the request
+	@returns 0 if the request was queued, or -1 if the disk is illegal, or the
+	  request is malformed (e.g., it is beyond the end of the disk).
+ */
+int bios_disk_submit(uint disk, disk_request* req);
+
+/**
+	@brief Take the completed requests of a disk.
+
+	This call returns the list of requests which have been completed 
+	since the last call, linked by their @c next field, in no particular order.
+
+	@param disk the disk
+	@returns the list of completed requests, or NULL if there is none
+ */
+disk_request* bios_disk_completed(uint disk);
+
+/**
+	@brief Assign a core to the interrupts from a disk.
+
+	By default, initially all interrupts are sent to core 0.
+	If any parameter has an illegal value, this call has no effect.
+ */
+void bios_disk_interrupt_core(uint disk, uint core);
+
+
+
 #endif
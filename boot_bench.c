@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "tinyos.h"
+
+
+/*
+	A benchmark of the startup time of tinyos.
+
+	It boots the system repeatedly, with an init task that returns at once,
+	and measures the time from the call to boot() until the init task 
+	starts, and until boot() returns.
+ */
+
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_nsec + t.tv_sec*1000000000ull;
+}
+
+static uint64_t init_start;
+
+static int init_task(int argl, void* args)
+{
+	init_start = now_ns();
+	return 0;
+}
+
+
+static int cmp_u64(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void report(const char* what, uint64_t* t, int n)
+{
+	qsort(t, n, sizeof(uint64_t), cmp_u64);
+	uint64_t sum = 0;
+	for(int i=0; i<n; i++) sum += t[i];
+	printf("%-16s min %9.1f us   median %9.1f us   mean %9.1f us\n", what,
+		t[0]/1E3, t[n/2]/1E3, sum/(n*1E3));
+}
+
+
+int main(int argc, const char** argv)
+{
+	if(argc > 3) {
+		printf("usage:\n  %s [<ncores>] [<boots>]\n\n"
+			"  Boot tinyos <boots> times (default: 100) on <ncores> cores (default: 1)\n"
+			"  and report the boot-to-init and boot-to-halt latency.\n", argv[0]);
+		exit(1);
+	}
+	unsigned int ncores = (argc > 1) ? atoi(argv[1]) : 1;
+	int nboots = (argc > 2) ? atoi(argv[2]) : 100;
+	if(nboots <= 0) nboots = 1;
+
+	uint64_t* to_init = malloc(nboots * sizeof(uint64_t));
+	uint64_t* to_halt = malloc(nboots * sizeof(uint64_t));
+
+	for(int i=0; i<nboots; i++) {
+		uint64_t start = now_ns();
+		boot(ncores, 0, init_task, 0, NULL);
+		to_halt[i] = now_ns() - start;
+		to_init[i] = init_start - start;
+	}
+
+	printf("%d boots on %u cores, MAX_PROC=%d\n", nboots, ncores, MAX_PROC);
+	report("boot-to-init", to_init, nboots);
+	report("boot-to-halt", to_halt, nboots);
+
+	free(to_init);
+	free(to_halt);
+	return 0;
+}
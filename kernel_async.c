@@ -0,0 +1,319 @@
+
+#include <assert.h>
+#include "tinyos.h"
+#include "kernel_cc.h"
+#include "kernel_sched.h"
+#include "kernel_proc.h"
+#include "kernel_streams.h"
+#include "kernel_socket.h"
+
+
+/**
+	@file kernel_async.c
+
+	@brief Asynchronous I/O with submission and completion rings.
+
+	A process creates an asynchronous context with @c AsyncSetup. The context
+	holds a submission ring and a completion ring, which are shared between
+	the process and the kernel.
+
+	Operations submitted via @c AsyncEnter are queued to a kernel-wide pool of
+	worker threads. A worker executes one operation at a time, on behalf of the
+	submitting process (it temporarily becomes a thread of that process),
+	and posts the result to the completion ring. Workers are created on demand
+	and exit when no asynchronous contexts exist.
+  */
+
+
+/* The maximum number of async worker threads */
+#define ASYNC_MAX_WORKERS 256
+
+
+typedef struct async_context
+{
+	async_ring ring;		/* The rings shared with the process */
+
+	unsigned int inflight;	/* Number of operations queued or executing */
+	int closed;				/* Set when the fid is closed */
+
+	CondVar completion;		/* Broadcast on each completion */
+	CondVar cancel;			/* Broadcast on close, to cancel timeouts */
+} async_ctx;
+
+
+typedef struct async_operation
+{
+	async_ctx* ctx;			/* The context this operation belongs to */
+	async_sqe sqe;			/* A copy of the submission entry */
+	PCB* proc;				/* The submitting process, pinned while the operation exists */
+	FCB* fcb;				/* The stream of the operation, or NULL for TIMEOUT */
+	rlnode node;			/* Intrusive node for async_pending */
+} async_op;
+
+
+/*
+	The worker pool. These are protected by the kernel lock.
+ */
+static rlnode async_pending = { .prev=&async_pending, .next=&async_pending };
+static unsigned int async_queued = 0;		/* length of async_pending */
+static CondVar async_work = COND_INIT;		/* workers wait here for operations */
+static unsigned int async_workers = 0;		/* number of worker threads */
+static unsigned int async_idle = 0;			/* number of idle worker threads */
+static unsigned int async_contexts = 0;		/* number of open contexts */
+
+
+static int async_close(void* this);
+
+static file_ops async_fops = {
+	.Open = NULL,
+	.Read = NULL,
+	.Write = NULL,
+	.Close = async_close
+};
+
+
+static void async_free_ctx(async_ctx* ctx)
+{
+	assert(ctx->closed && ctx->inflight==0);
+	free(ctx);
+}
+
+
+/*
+	Post a completion. Room for it was reserved at submission.
+ */
+static void async_complete(async_ctx* ctx, uintptr_t user_data, int result)
+{
+	async_ring* r = & ctx->ring;
+	unsigned int tail = r->cq_tail;
+
+	assert(tail - r->cq_head < r->cq_entries);
+	r->cq[tail & (r->cq_entries-1)] = (async_cqe){ .user_data=user_data, .result=result };
+	__atomic_store_n(& r->cq_tail, tail+1, __ATOMIC_RELEASE);
+
+	kernel_broadcast(& ctx->completion);
+}
+
+
+/*
+	Execute an operation. This is called by a worker with the kernel
+	lock held; the worker executes on behalf of the submitting process.
+ */
+static int async_execute(async_op* op)
+{
+	async_sqe* sqe = & op->sqe;
+	FCB* fcb = op->fcb;
+
+	switch(sqe->opcode) {
+		case ASYNC_READ:
+			return fcb->streamfunc->Read ? fcb->streamfunc->Read(fcb->streamobj, sqe->buf, sqe->size) : -1;
+		case ASYNC_WRITE:
+			return fcb->streamfunc->Write ? fcb->streamfunc->Write(fcb->streamobj, sqe->buf, sqe->size) : -1;
+		case ASYNC_ACCEPT:
+			return socket_accept(fcb);
+		case ASYNC_CONNECT:
+			return socket_connect(fcb, sqe->port, sqe->timeout);
+		case ASYNC_TIMEOUT:
+			/* Nobody signals ctx->cancel, unless the context is closed */
+			return kernel_timedwait(& op->ctx->cancel, SCHED_USER, sqe->timeout*1000ul) ? -1 : 0;
+		default:
+			return -1;
+	}
+}
+
+
+static void async_worker()
+{
+	TCB* self = cur_thread();
+
+	kernel_lock();
+
+	while(1) {
+		while(is_rlist_empty(& async_pending) && async_contexts > 0) {
+			async_idle++;
+			kernel_wait(& async_work, SCHED_IO);
+			async_idle--;
+		}
+		if(is_rlist_empty(& async_pending)) break;
+
+		async_op* op = rlist_pop_front(& async_pending)->obj;
+		async_queued--;
+		async_ctx* ctx = op->ctx;
+
+		int result = -1;
+		if(! ctx->closed && op->proc->pstate == ALIVE) {
+			/* Borrow the process of the submitter */
+			self->owner_pcb = op->proc;
+			result = async_execute(op);
+
+			/* If the submitter exited meanwhile, nobody will close the new socket */
+			if(op->proc->pstate != ALIVE && op->sqe.opcode == ASYNC_ACCEPT && result != NOFILE) {
+				sys_Close(result);
+				result = NOFILE;
+			}
+			self->owner_pcb = get_pcb(0);
+		}
+
+		if(op->fcb) FCB_decref(op->fcb);
+		unpin_PCB(op->proc);
+
+		ctx->inflight--;
+		if(! ctx->closed)
+			async_complete(ctx, op->sqe.user_data, result);
+		else if(ctx->inflight == 0)
+			async_free_ctx(ctx);
+
+		free(op);
+	}
+
+	async_workers--;
+	kernel_sleep(EXITED, SCHED_USER);
+}
+
+
+/*
+	Queue an operation to the worker pool, spawning a new worker if
+	there are not enough idle ones.
+ */
+static void async_queue(async_op* op)
+{
+	rlnode_init(& op->node, op);
+	rlist_push_back(& async_pending, & op->node);
+	async_queued++;
+	op->ctx->inflight++;
+
+	if(async_queued > async_idle && async_workers < ASYNC_MAX_WORKERS) {
+		TCB* tcb = spawn_thread(get_pcb(0), async_worker);
+		async_workers++;
+		wakeup(tcb);
+	}
+	else
+		kernel_signal(& async_work);
+}
+
+
+static void async_submit(async_ctx* ctx, async_sqe* sqe)
+{
+	FCB* fcb = NULL;
+
+	switch(sqe->opcode) {
+		case ASYNC_NOP:
+			async_complete(ctx, sqe->user_data, 0);
+			return;
+		case ASYNC_READ:
+		case ASYNC_WRITE:
+		case ASYNC_ACCEPT:
+		case ASYNC_CONNECT:
+			/* The stream is resolved at submission time */
+			fcb = get_fcb(sqe->fid);
+			if(fcb == NULL) {
+				async_complete(ctx, sqe->user_data, -1);
+				return;
+			}
+			FCB_incref(fcb);
+			break;
+		case ASYNC_TIMEOUT:
+			break;
+		default:
+			async_complete(ctx, sqe->user_data, -1);
+			return;
+	}
+
+	async_op* op = xmalloc(sizeof(async_op));
+	op->ctx = ctx;
+	op->sqe = *sqe;
+	op->proc = CURPROC;
+	op->fcb = fcb;
+
+	/* The submitter may exit, and be reaped, before the operation runs */
+	pin_PCB(op->proc);
+	async_queue(op);
+}
+
+
+static int async_close(void* this)
+{
+	async_ctx* ctx = this;
+
+	ctx->closed = 1;
+	async_contexts--;
+
+	kernel_broadcast(& ctx->cancel);
+	if(async_contexts == 0)
+		kernel_broadcast(& async_work);  /* idle workers will exit */
+
+	if(ctx->inflight == 0)
+		async_free_ctx(ctx);
+	return 0;
+}
+
+
+Fid_t sys_AsyncSetup(unsigned int entries, async_ring** ring)
+{
+	if(entries == 0 || entries > ASYNC_MAX_ENTRIES || ring == NULL)
+		return NOFILE;
+
+	/* Round up to a power of 2 */
+	unsigned int sqn = 1;
+	while(sqn < entries) sqn <<= 1;
+	unsigned int cqn = 2*sqn;
+
+	Fid_t fid;
+	FCB* fcb;
+	if(! FCB_reserve(1, &fid, &fcb))
+		return NOFILE;
+
+	/* Allocate the context and the two rings in one block */
+	async_ctx* ctx = xmalloc(sizeof(async_ctx) + sqn*sizeof(async_sqe) + cqn*sizeof(async_cqe));
+	ctx->ring.sq_entries = sqn;
+	ctx->ring.cq_entries = cqn;
+	ctx->ring.sq_head = ctx->ring.sq_tail = 0;
+	ctx->ring.cq_head = ctx->ring.cq_tail = 0;
+	ctx->ring.sq = (async_sqe*) (ctx+1);
+	ctx->ring.cq = (async_cqe*) (ctx->ring.sq + sqn);
+	ctx->inflight = 0;
+	ctx->closed = 0;
+	ctx->completion = COND_INIT;
+	ctx->cancel = COND_INIT;
+
+	fcb->streamobj = ctx;
+	fcb->streamfunc = &async_fops;
+	async_contexts++;
+
+	*ring = & ctx->ring;
+	return fid;
+}
+
+
+int sys_AsyncEnter(Fid_t fid, unsigned int to_submit, unsigned int min_complete)
+{
+	FCB* fcb = get_fcb(fid);
+	if(fcb == NULL || fcb->streamfunc != &async_fops)
+		return -1;
+
+	async_ctx* ctx = fcb->streamobj;
+	async_ring* r = & ctx->ring;
+
+	/* Consume submissions, as long as there is room for their completions */
+	unsigned int submitted = 0;
+	while(submitted < to_submit) {
+		unsigned int head = r->sq_head;
+		if(head == __atomic_load_n(& r->sq_tail, __ATOMIC_ACQUIRE)) break;
+		if(ctx->inflight + (r->cq_tail - r->cq_head) >= r->cq_entries) break;
+
+		async_sqe sqe = r->sq[head & (r->sq_entries-1)];
+		__atomic_store_n(& r->sq_head, head+1, __ATOMIC_RELEASE);
+
+		async_submit(ctx, &sqe);
+		submitted++;
+	}
+
+	/* Make sure that the context is not released while we wait */
+	FCB_incref(fcb);
+	while(r->cq_tail - r->cq_head < min_complete && ctx->inflight > 0)
+		kernel_wait(& ctx->completion, SCHED_IO);
+	FCB_decref(fcb);
+
+	return submitted;
+}
+
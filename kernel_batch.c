@@ -0,0 +1,50 @@
+
+#include "tinyos.h"
+#include "kernel_sys.h"
+
+
+/**
+	@file kernel_batch.c
+
+	@brief System call batches.
+
+	A batch is a vector of system call descriptors, executed in order
+	under a single acquisition of the kernel lock.
+  */
+
+
+static intptr_t batch_execute(batch_op* op)
+{
+	switch(op->opcode) {
+		case BATCH_READ:
+			return sys_Read(op->fid, op->buf, op->size);
+		case BATCH_WRITE:
+			return sys_Write(op->fid, op->buf, op->size);
+		case BATCH_CLOSE:
+			return sys_Close(op->fid);
+		case BATCH_DUP2:
+			return sys_Dup2(op->fid, op->newfid);
+		case BATCH_PIPE:
+			return op->buf ? sys_Pipe(op->buf) : -1;
+		case BATCH_SEEK:
+			return sys_Seek(op->fid, op->offset, op->whence);
+		default:
+			return -1;
+	}
+}
+
+
+int sys_SyscallBatch(batch_op* ops, unsigned int n, int flags)
+{
+	if(ops == NULL) return -1;
+
+	unsigned int i;
+	for(i=0; i<n; i++) {
+		ops[i].result = batch_execute(&ops[i]);
+		if(ops[i].result < 0 && (flags & BATCH_STOP_ON_ERROR)) {
+			i++;
+			break;
+		}
+	}
+	return i;
+}
@@ -0,0 +1,408 @@
+
+#include <assert.h>
+#include "kernel_cc.h"
+#include "kernel_sched.h"
+#include "kernel_proc.h"
+#include "kernel_bcache.h"
+
+
+/**
+	@file kernel_bcache.c
+
+	@brief The block buffer cache.
+  */
+
+
+/* The number of buckets of the hash table; a power of 2 */
+#define BCACHE_HASH 512
+
+/* The number of blocks read ahead of a sequential reader */
+#define BCACHE_READAHEAD 4
+
+/* The delay of write-back, in usec */
+#define BCACHE_WRITEBACK_DELAY 50000
+
+
+/* The buffers. A buffer is free when its data is NULL. */
+static bcache_buf BUF[BCACHE_BUFFERS];
+static unsigned int bcache_used;		/* Buffers with data != NULL */
+static unsigned int bcache_hand;		/* The CLOCK hand */
+static unsigned int bcache_dirty;		/* Number of dirty buffers */
+
+static rlnode bcache_hash[BCACHE_HASH];
+static CondVar bcache_released;			/* Broadcast when a buffer is unpinned */
+
+/* The daemon */
+static int bcache_daemon_running;
+static CondVar bcache_kick;
+static rlnode bcache_ra_queue;			/* Locked buffers to read ahead */
+
+/* Per-device state and statistics */
+static struct {
+	uint64_t last_block;				/* The last block read, for read-ahead */
+	bcache_info info;
+} bcache_dev[MAX_DISKS];
+
+
+void initialize_bcache()
+{
+	for(int i=0; i<BCACHE_BUFFERS; i++) {
+		BUF[i].data = NULL;
+		BUF[i].unlocked = COND_INIT;
+		rlnode_init(& BUF[i].hash_node, &BUF[i]);
+		rlnode_init(& BUF[i].ra_node, &BUF[i]);
+	}
+	for(int i=0; i<BCACHE_HASH; i++)
+		rlnode_init(& bcache_hash[i], NULL);
+
+	bcache_used = bcache_hand = bcache_dirty = 0;
+	bcache_released = COND_INIT;
+
+	bcache_daemon_running = 0;
+	bcache_kick = COND_INIT;
+	rlnode_init(& bcache_ra_queue, NULL);
+
+	for(int d=0; d<MAX_DISKS; d++) {
+		bcache_dev[d].last_block = (uint64_t)-2;
+		bcache_dev[d].info = (bcache_info){ .dev = d };
+	}
+}
+
+
+void finalize_bcache()
+{
+	assert(bcache_dirty == 0);
+	for(int i=0; i<bcache_used; i++) {
+		free(BUF[i].data);
+		BUF[i].data = NULL;
+	}
+	bcache_used = 0;
+}
+
+
+uint64_t bcache_blocks(uint dev)
+{
+	return (blkdev_sectors(dev) + BCACHE_BLOCK_SECTORS - 1) / BCACHE_BLOCK_SECTORS;
+}
+
+
+uint bcache_block_sectors(uint dev, uint64_t block)
+{
+	uint64_t left = blkdev_sectors(dev) - block*BCACHE_BLOCK_SECTORS;
+	return left < BCACHE_BLOCK_SECTORS ? left : BCACHE_BLOCK_SECTORS;
+}
+
+
+static inline rlnode* bcache_bucket(uint dev, uint64_t block)
+{
+	uint64_t h = (block * 0x9E3779B97F4A7C15ull) ^ dev;
+	return & bcache_hash[(h >> 32) & (BCACHE_HASH-1)];
+}
+
+
+static bcache_buf* bcache_lookup(uint dev, uint64_t block)
+{
+	rlnode* bucket = bcache_bucket(dev, block);
+	for(rlnode* p = bucket->next; p != bucket; p = p->next) {
+		bcache_buf* b = p->obj;
+		if(b->dev == dev && b->block == block) return b;
+	}
+	return NULL;
+}
+
+
+static void block_io(bcache_buf* b, disk_op op)
+{
+	assert(b->locked);
+	int rc = blkdev_io(b->dev, op, b->block*BCACHE_BLOCK_SECTORS, 
+		bcache_block_sectors(b->dev, b->block), b->data);
+	if(op == DISK_OP_READ)
+		b->valid = (rc == 0);
+}
+
+
+static void buf_lock(bcache_buf* b)
+{
+	while(b->locked)
+		kernel_wait(& b->unlocked, SCHED_IO);
+	b->locked = 1;
+}
+
+
+/*
+	Write back a dirty buffer. The buffer must be pinned by the caller.
+	If the write fails, the data is lost; keeping the buffer dirty
+	would keep the daemon (and the kernel) alive for ever.
+ */
+static void bcache_writeback(bcache_buf* b)
+{
+	buf_lock(b);
+	if(b->dirty) {
+		b->dirty = 0;
+		bcache_dirty--;
+		bcache_dev[b->dev].info.writebacks++;
+		block_io(b, DISK_OP_WRITE);
+	}
+	b->locked = 0;
+	kernel_broadcast(& b->unlocked);
+}
+
+
+/*
+	Find a buffer to hold a new block. The buffer is returned unhashed.
+	If there is no clean, unpinned buffer, return NULL and store a dirty,
+	unpinned buffer (if one exists) in *dirty.
+ */
+static bcache_buf* bcache_victim(bcache_buf** dirty)
+{
+	*dirty = NULL;
+
+	if(bcache_used < BCACHE_BUFFERS) {
+		bcache_buf* b = & BUF[bcache_used++];
+		b->data = xmalloc(BCACHE_BLOCK_SIZE);
+		return b;
+	}
+
+	/* Two sweeps of the clock clear all reference bits */
+	for(int i=0; i < 2*BCACHE_BUFFERS; i++) {
+		bcache_buf* b = & BUF[bcache_hand];
+		bcache_hand = (bcache_hand+1) % BCACHE_BUFFERS;
+
+		if(b->pins) continue;
+		if(b->ref) { b->ref = 0; continue; }
+		if(b->dirty) { *dirty = b; continue; }
+
+		rlist_remove(& b->hash_node);
+		bcache_dev[b->dev].info.evictions++;
+		return b;
+	}
+	return NULL;
+}
+
+
+/* Hash a victim buffer for a block, pinned and locked */
+static bcache_buf* bcache_assign(bcache_buf* b, uint dev, uint64_t block)
+{
+	b->dev = dev;
+	b->block = block;
+	b->valid = 0;
+	b->dirty = 0;
+	b->ref = 1;
+	b->pins = 1;
+	b->locked = 1;
+	rlist_push_front(bcache_bucket(dev, block), & b->hash_node);
+	return b;
+}
+
+
+bcache_buf* bget(uint dev, uint64_t block)
+{
+	if(block >= bcache_blocks(dev)) return NULL;
+
+	while(1) {
+		bcache_buf* b = bcache_lookup(dev, block);
+		if(b) {
+			b->pins++;
+			buf_lock(b);
+			b->ref = 1;
+			return b;
+		}
+
+		bcache_buf* dirty;
+		b = bcache_victim(&dirty);
+		if(b) return bcache_assign(b, dev, block);
+
+		/* We may block, so the cache may change; we must look again */
+		if(dirty) {
+			dirty->pins++;
+			bcache_writeback(dirty);
+			dirty->pins--;
+			if(dirty->pins == 0) kernel_broadcast(& bcache_released);
+		}
+		else
+			kernel_wait(& bcache_released, SCHED_IO);
+	}
+}
+
+
+static void bcache_daemon();
+
+static void bcache_start_daemon()
+{
+	if(! bcache_daemon_running) {
+		TCB* tcb = spawn_thread(get_pcb(0), bcache_daemon);
+		bcache_daemon_running = 1;
+		wakeup(tcb);
+	}
+}
+
+
+/*
+	Queue blocks following 'block' for read-ahead, if they are not cached
+	and there are free buffers.
+ */
+static void bcache_readahead(uint dev, uint64_t block)
+{
+	uint64_t nblocks = bcache_blocks(dev);
+	for(uint64_t k = block+1; k <= block+BCACHE_READAHEAD && k < nblocks; k++) {
+		if(bcache_lookup(dev, k)) continue;
+
+		bcache_buf* dirty;
+		bcache_buf* b = bcache_victim(&dirty);
+		if(b == NULL) break;
+
+		bcache_assign(b, dev, k);
+		rlist_push_back(& bcache_ra_queue, & b->ra_node);
+		bcache_dev[dev].info.readaheads++;
+	}
+
+	if(! is_rlist_empty(& bcache_ra_queue)) {
+		bcache_start_daemon();
+		kernel_signal(& bcache_kick);
+	}
+}
+
+
+bcache_buf* bread(uint dev, uint64_t block)
+{
+	bcache_buf* b = bget(dev, block);
+	if(b == NULL) return NULL;
+
+	bcache_info* info = & bcache_dev[dev].info;
+	if(b->valid) 
+		info->hits++;
+	else {
+		info->misses++;
+		block_io(b, DISK_OP_READ);
+	}
+
+	/* Detect sequential reads */
+	if(block == bcache_dev[dev].last_block+1)
+		bcache_readahead(dev, block);
+	bcache_dev[dev].last_block = block;
+
+	if(! b->valid) {
+		brelse(b);
+		return NULL;
+	}
+	return b;
+}
+
+
+void bdirty(bcache_buf* b)
+{
+	assert(b->locked);
+	b->valid = 1;
+	if(! b->dirty) {
+		b->dirty = 1;
+		bcache_dirty++;
+		bcache_start_daemon();
+	}
+}
+
+
+void brelse(bcache_buf* b)
+{
+	assert(b->locked && b->pins > 0);
+	b->locked = 0;
+	b->pins--;
+	if(b->pins) 
+		kernel_broadcast(& b->unlocked);
+	else
+		kernel_broadcast(& bcache_released);
+}
+
+
+bcache_buf* bmap(uint dev, uint64_t block)
+{
+	bcache_buf* b = bread(dev, block);
+	if(b == NULL) return NULL;
+
+	/* Keep a pin after unlocking */
+	b->pins++;
+	brelse(b);
+	return b;
+}
+
+
+void bunmap(bcache_buf* b)
+{
+	assert(b->pins > 0);
+	b->pins--;
+	if(b->pins == 0) kernel_broadcast(& bcache_released);
+}
+
+
+/*
+	Write back the dirty buffers that are not locked. A locked buffer is
+	in use, and will be flushed later. Pins do not matter here: a memory
+	mapping holds a pin for as long as it exists.
+ */
+static void bcache_flush()
+{
+	for(int i=0; i<bcache_used; i++) {
+		bcache_buf* b = & BUF[i];
+		if(b->dirty && ! b->locked) {
+			b->pins++;
+			bcache_writeback(b);
+			b->pins--;
+			if(b->pins == 0) kernel_broadcast(& bcache_released);
+		}
+	}
+}
+
+
+/*
+	The daemon performs read-ahead as soon as it is requested, and
+	writes back dirty buffers once per write-back period, however often 
+	it is kicked. It exits when there is no work.
+ */
+static void bcache_daemon()
+{
+	const uint64_t period = BCACHE_WRITEBACK_DELAY * 1000ull;
+	kernel_lock();
+	uint64_t last_flush = bios_clock_ns();
+
+	while(1) {
+		while(! is_rlist_empty(& bcache_ra_queue)) {
+			bcache_buf* b = rlist_pop_front(& bcache_ra_queue)->obj;
+			block_io(b, DISK_OP_READ);
+			brelse(b);
+		}
+
+		if(bcache_dirty == 0) break;
+
+		uint64_t elapsed = bios_clock_ns() - last_flush;
+		if(elapsed >= period) {
+			bcache_flush();
+			last_flush = bios_clock_ns();
+		}
+		else
+			kernel_timedwait(& bcache_kick, SCHED_IO, (period - elapsed)/1000 + 1);
+	}
+
+	bcache_daemon_running = 0;
+	kernel_sleep(EXITED, SCHED_IO);
+}
+
+
+size_t bcache_sysinfo(void** info)
+{
+	uint ndev = device_no(DEV_BLOCK);
+	bcache_info* rec = xmalloc(ndev * sizeof(bcache_info) + 1);
+
+	for(uint d=0; d<ndev; d++) {
+		rec[d] = bcache_dev[d].info;
+		rec[d].buffers = rec[d].dirty = 0;
+	}
+	for(int i=0; i<bcache_used; i++) {
+		bcache_buf* b = & BUF[i];
+		if(b->hash_node.next == & b->hash_node) continue;  /* not hashed */
+		rec[b->dev].buffers++;
+		if(b->dirty) rec[b->dev].dirty++;
+	}
+
+	*info = rec;
+	return ndev * sizeof(bcache_info);
+}
+
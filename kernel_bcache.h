@@ -0,0 +1,147 @@
+#ifndef __KERNEL_BCACHE_H
+#define __KERNEL_BCACHE_H
+
+#include "kernel_dev.h"
+
+/**
+  @file kernel_bcache.h
+  @brief The block buffer cache.
+
+  @defgroup bcache Buffer cache
+  @ingroup kernel
+  @brief The block buffer cache.
+
+  The buffer cache holds blocks of the block devices in memory. A block 
+  is @c BCACHE_BLOCK_SIZE bytes, i.e., @c BCACHE_BLOCK_SECTORS consecutive
+  sectors of a device. Buffers are kept in a hash table keyed by (device, block)
+  and are replaced by the CLOCK algorithm.
+
+  A buffer is obtained by @c bread (or @c bget), which returns it locked, and 
+  must be released by @c brelse. Modified buffers are marked by @c bdirty and 
+  they are written back by a kernel daemon. The daemon also performs
+  read-ahead, when sequential reads of a device are detected.
+
+  The daemon is created on demand and exits when there is no work left,
+  so the kernel shuts down only after all dirty buffers are written back.
+
+  All functions must be called with the kernel lock held.
+
+  @{
+*/
+
+/** @brief The number of sectors of a block */
+#define BCACHE_BLOCK_SECTORS 8
+
+/** @brief The size of a block in bytes */
+#define BCACHE_BLOCK_SIZE (BCACHE_BLOCK_SECTORS*DISK_SECTOR_SIZE)
+
+/** @brief The number of buffers in the cache */
+#define BCACHE_BUFFERS 256
+
+
+/**
+  @brief A buffer of the cache.
+  */
+typedef struct buffer_cache_block {
+  uint dev;                 /**< @brief The block device */
+  uint64_t block;           /**< @brief The block number */
+  char* data;               /**< @brief The contents of the block */
+
+  int valid;                /**< @brief Set when @c data has been read */
+  int dirty;                /**< @brief Set when @c data must be written back */
+  int ref;                  /**< @brief The CLOCK reference bit */
+
+  unsigned int pins;        /**< @brief Number of threads holding or waiting for the buffer,
+                                   plus the number of memory mappings */
+  int locked;               /**< @brief The buffer lock */
+  CondVar unlocked;         /**< @brief Waiters for the buffer lock */
+
+  rlnode hash_node;         /**< @brief Intrusive node for the hash table */
+  rlnode ra_node;           /**< @brief Intrusive node for the read-ahead queue */
+} bcache_buf;
+
+
+/**
+  @brief Initialize the buffer cache.
+
+  No buffer memory is allocated until it is needed.
+  */
+void initialize_bcache();
+
+/**
+  @brief Release the memory of the buffer cache.
+
+  This is called at shutdown, after all dirty buffers have been written back.
+  */
+void finalize_bcache();
+
+
+/**
+  @brief Get a locked buffer for a block, without reading it.
+
+  This is useful when the whole block is about to be overwritten. If the
+  buffer is not valid, the caller must fill its data and set @c valid.
+
+  @returns the buffer, or NULL if the block does not exist
+  */
+bcache_buf* bget(uint dev, uint64_t block);
+
+/**
+  @brief Get a locked buffer with the contents of a block.
+
+  @returns the buffer, or NULL if the block does not exist or there 
+    was an I/O error.
+  */
+bcache_buf* bread(uint dev, uint64_t block);
+
+/**
+  @brief Mark a locked buffer as modified.
+  */
+void bdirty(bcache_buf* buf);
+
+/**
+  @brief Unlock and release a buffer.
+  */
+void brelse(bcache_buf* buf);
+
+/**
+  @brief Get a pinned, unlocked buffer with the contents of a block.
+
+  The buffer cannot be replaced until it is released by @c bunmap, so its 
+  data can be accessed directly by memory mappings.
+
+  @returns the buffer, or NULL if the block does not exist or there 
+    was an I/O error.
+  */
+bcache_buf* bmap(uint dev, uint64_t block);
+
+/**
+  @brief Release a buffer obtained by @c bmap.
+  */
+void bunmap(bcache_buf* buf);
+
+/**
+  @brief Return the number of blocks of a device.
+  */
+uint64_t bcache_blocks(uint dev);
+
+/**
+  @brief Return the number of sectors of a block.
+
+  This is @c BCACHE_BLOCK_SECTORS, except possibly for the last block of the device.
+  */
+uint bcache_block_sectors(uint dev, uint64_t block);
+
+/**
+  @brief Return a snapshot of the statistics of the buffer cache.
+
+  An array of @c bcache_info records, one per block device, is allocated
+  and stored in @c *info.
+
+  @returns the size of the array in bytes
+  */
+size_t bcache_sysinfo(void** info);
+
+/** @} */
+
+#endif
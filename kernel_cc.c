@@ -252,12 +252,16 @@ void kernel_unlock()
 int kernel_wait_wchan(CondVar* cv, enum SCHED_CAUSE cause, 
 	const char* wchan_name, TimerDuration timeout)
 {
+	TCB* self = cur_thread();
+	uint64_t start = bios_clock_ns();
+
 	/* Atomically release kernel semaphore */
 	Mutex_Lock(& kernel_mutex);
 	kernel_sem++;
 	Cond_Signal(&kernel_sem_cv);	
 
 	int ret = cv_wait(&kernel_mutex, cv, cause, timeout);
+	account_wait(self, start);
 
 	/* Reacquire kernel semaphore */
 	while(kernel_sem<=0)
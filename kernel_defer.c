@@ -0,0 +1,145 @@
+
+#include <assert.h>
+#include "tinyos.h"
+#include "kernel_cc.h"
+#include "kernel_sched.h"
+#include "kernel_defer.h"
+
+
+/**
+	@file kernel_defer.c
+
+	@brief Per-core queues of deferred work.
+
+	Each core has a queue of work items, which is filled by the interrupt
+	handlers that run on the core, and drained by the worker of the core.
+	A queue is protected by a spinlock, taken with preemption off, so that
+	the interrupt handlers of the core cannot contend on it. The worker is
+	put to sleep atomically with the release of the spinlock, so a wakeup
+	cannot be lost.
+  */
+
+
+typedef struct defer_queue
+{
+	Mutex lock;				/* Taken with preemption off */
+	rlnode items;			/* The queued work items */
+	unsigned int depth;		/* The length of items */
+	defer_info info;		/* The statistics of this queue */
+} defer_queue;
+
+
+static defer_queue defer_table[MAX_CORES];
+
+
+void initialize_defer()
+{
+	for(int i=0; i<MAX_CORES; i++) {
+		defer_table[i].lock = MUTEX_INIT;
+		rlnode_init(& defer_table[i].items, NULL);
+		defer_table[i].depth = 0;
+		defer_table[i].info = (defer_info){ .core = i };
+	}
+}
+
+
+void defer_init(deferred_work* work, void (*func)(deferred_work*))
+{
+	work->func = func;
+	rlnode_init(& work->node, work);
+	work->pending = 0;
+	work->queued_ns = 0;
+}
+
+
+int defer_work(deferred_work* work)
+{
+	int pre = preempt_off;
+	defer_queue* q = & defer_table[cpu_core_id];
+
+	Mutex_Lock(& q->lock);
+
+	/* The item may be pending at the queue of another core */
+	int queued = ! __atomic_exchange_n(& work->pending, 1, __ATOMIC_ACQ_REL);
+	if(queued) {
+		work->queued_ns = bios_clock_ns();
+		rlist_push_back(& q->items, & work->node);
+		q->info.queued++;
+		if(++q->depth > q->info.max_depth) q->info.max_depth = q->depth;
+
+		/* The worker may not have started yet; it will find the item when it does */
+		TCB* worker = cctx[cpu_core_id].worker;
+		if(worker != NULL && wakeup(worker))
+			q->info.wakeups++;
+	}
+	else
+		q->info.coalesced++;
+
+	Mutex_Unlock(& q->lock);
+
+	if(pre) preempt_on;
+	return queued;
+}
+
+
+void defer_yield(int preempt)
+{
+	TCB* worker = cctx[cpu_core_id].worker;
+	if(preempt && worker != NULL && worker->state == READY)
+		yield(SCHED_DEFER);
+}
+
+
+void defer_worker()
+{
+	/* The worker only runs on its own core */
+	defer_queue* q = & defer_table[cpu_core_id];
+
+	preempt_off;
+	Mutex_Lock(& q->lock);
+
+	while(1) {
+		while(is_rlist_empty(& q->items)) {
+			sleep_releasing(STOPPED, & q->lock, SCHED_IO, NO_TIMEOUT);
+			Mutex_Lock(& q->lock);
+		}
+
+		deferred_work* work = rlist_pop_front(& q->items)->obj;
+		q->depth--;
+
+		uint64_t latency = bios_clock_ns() - work->queued_ns;
+		q->info.runs++;
+		q->info.latency_ns += latency;
+		if(latency > q->info.max_latency_ns) q->info.max_latency_ns = latency;
+
+		/* From now on, the item may be queued again */
+		__atomic_store_n(& work->pending, 0, __ATOMIC_RELEASE);
+
+		Mutex_Unlock(& q->lock);
+		preempt_on;
+
+		work->func(work);
+
+		preempt_off;
+		Mutex_Lock(& q->lock);
+	}
+}
+
+
+size_t defer_sysinfo(void** info)
+{
+	uint ncores = cpu_cores();
+	defer_info* rec = xmalloc(ncores * sizeof(defer_info));
+
+	for(uint c=0; c<ncores; c++) {
+		int pre = preempt_off;
+		Mutex_Lock(& defer_table[c].lock);
+		rec[c] = defer_table[c].info;
+		rec[c].depth = defer_table[c].depth;
+		Mutex_Unlock(& defer_table[c].lock);
+		if(pre) preempt_on;
+	}
+
+	*info = rec;
+	return ncores * sizeof(defer_info);
+}
@@ -0,0 +1,84 @@
+#ifndef __KERNEL_DEFER_H
+#define __KERNEL_DEFER_H
+
+#include "util.h"
+
+/**
+  @file kernel_defer.h
+  @brief Deferred work: the bottom halves of interrupt handlers.
+
+  An interrupt handler (the top half) should do as little as possible with
+  preemption off. The rest of its work is packaged as a @c deferred_work item
+  and queued to the current core by @c defer_work. Each core has a kernel worker
+  thread, which runs the items queued to its core, in thread context.
+
+  The worker of a core is selected by the scheduler of the core ahead of any
+  other thread. If the interrupted thread was in the preemptive domain, the
+  top half calls @c defer_yield on exit, so that the queued work runs before
+  the interrupted thread resumes.
+*/
+
+
+/**
+  @brief A unit of deferred work.
+
+  Work items are usually embedded in the driver data. An item is queued
+  at most once: queueing an item that is already pending has no effect,
+  so that the work of many interrupts may be coalesced into one run.
+  */
+typedef struct deferred_work
+{
+  void (*func)(struct deferred_work*);  /**< @brief The function that does the work */
+  rlnode node;                          /**< @brief Node for the queue of a core */
+  int pending;                          /**< @brief Set while the item is queued */
+  uint64_t queued_ns;                   /**< @brief The time the item was queued */
+} deferred_work;
+
+
+/** @brief Initialize a work item, to run @c func. */
+void defer_init(deferred_work* work, void (*func)(deferred_work*));
+
+/**
+  @brief Queue a work item to the current core.
+
+  This can be called from an interrupt handler. The function of the item will be
+  called later by the worker of the core, with preemption on. It may take
+  spinlocks (with preemption off), but it must not block.
+
+  @returns 1 if the item was queued, 0 if it was already pending
+  */
+int defer_work(deferred_work* work);
+
+/**
+  @brief Let the worker of the current core run, if it has work.
+
+  This is called at the end of an interrupt handler. The argument is the
+  preemption state of the interrupted thread (as returned by @c preempt_off
+  at the start of the handler); if it is 0, the thread is not preempted, and the
+  work runs at the next context switch of the core.
+  */
+void defer_yield(int preempt);
+
+/**
+  @brief The body of the worker thread of a core.
+
+  The scheduler creates one worker per core as it starts.
+  */
+void defer_worker();
+
+/**
+  @brief Initialize the deferred work queues.
+
+  This is called at boot.
+  */
+void initialize_defer();
+
+/**
+  @brief Return the statistics of the work queues, as an array of @c defer_info.
+
+  The array is allocated by @c xmalloc and must be freed by the caller.
+  @returns the size of the array in bytes
+  */
+size_t defer_sysinfo(void** info);
+
+#endif
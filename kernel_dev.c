@@ -5,6 +5,8 @@
 #include "kernel_sched.h"
 #include "kernel_streams.h"
 #include "kernel_proc.h"
+#include "kernel_bcache.h"
+#include "kernel_defer.h"
 
 /*************************************
 
@@ -66,104 +68,478 @@ static file_ops nulldev_fops = {
 void serial_rx_handler();
 void serial_tx_handler();
 
+/* The size of the output ring of a terminal (a power of 2) */
+#define SERIAL_TX_RING 4096
+
+/* The size of the input ring of a terminal (a power of 2) */
+#define SERIAL_RX_RING 4096
+
+/* Control characters of the canonical mode */
+#define CHAR_EOF   0x04   /* Ctrl-D */
+#define CHAR_KILL  0x15   /* Ctrl-U */
+#define CHAR_BS    0x08
+#define CHAR_DEL   0x7f
+
 typedef struct serial_device_control_block {
   uint devno;
-  Mutex spinlock;
-  CondVar rx_ready;
+  Mutex spinlock;       /* Protects the rings and the mode. Taken with preemption off. */
+  CondVar rx_ready;     /* Broadcast when bytes become readable */
+  CondVar tx_ready;     /* Broadcast when bytes leave the TX ring */
+  int mode;             /* The TERM_* flags of the line discipline */
+
+  unsigned int rx_head; /* The next byte to read */
+  unsigned int rx_line; /* The end of the readable bytes; after it is the line being edited */
+  unsigned int rx_tail; /* The next free position in the ring */
+  char rx_ring[SERIAL_RX_RING];
+
+  unsigned int tx_head; /* The next byte to send to the device */
+  unsigned int tx_tail; /* The next free position in the ring */
+  char tx_ring[SERIAL_TX_RING];
 } serial_dcb_t;
 
 serial_dcb_t serial_dcb[MAX_TERMINALS];
 
+/* The stream object of an open terminal */
+typedef struct serial_stream {
+  serial_dcb_t* dcb;
+  unsigned int tx_mark; /* The end of the last output of this stream in the TX ring */
+} serial_stream;
+
+/* The bottom halves of serial_rx_handler and serial_tx_handler */
+static deferred_work serial_rx_work;
+static deferred_work serial_tx_work;
+
+/* The terminals whose interrupts await the bottom halves, one bit per terminal */
+static uint32_t serial_rx_pending;
+static uint32_t serial_tx_pending;
 
 
 /*
-  Interrupt-driven driver for serial-device reads.
+  Interrupt routing.
+
+  The interrupts of a terminal (both RX and TX) go to one core. Terminals are 
+  spread over the cores at boot. Then, once per period, a bottom half moves a 
+  terminal from the core with the most serial interrupts in the period to the
+  core with the fewest, preferring idle cores.
  */
 
-void serial_rx_handler()
+/* The period of rebalancing, in nsec */
+#define SERIAL_BALANCE_PERIOD 100000000ull
+
+/* The minimum imbalance, in interrupts per period, that causes a move */
+#define SERIAL_BALANCE_MIN 8
+
+typedef struct serial_route {
+  uint core;                  /* The core that receives the interrupts */
+  unsigned long rx_irqs;      /* The SERIAL_RX_READY interrupts of the terminal */
+  unsigned long tx_irqs;      /* The SERIAL_TX_READY interrupts of the terminal */
+  unsigned long period_irqs;  /* The interrupts in the current period */
+  unsigned long moves;        /* The times the terminal was moved */
+} serial_route;
+
+static serial_route serial_routes[MAX_TERMINALS];
+static uint64_t serial_balance_time;  /* The start of the current period */
+
+static void serial_route_to(uint term, uint core)
 {
-  int pre = preempt_off;
+  serial_routes[term].core = core;
+  bios_serial_interrupt_core(term, SERIAL_RX_READY, core);
+  bios_serial_interrupt_core(term, SERIAL_TX_READY, core);
+}
 
-  /* 
-    We do not know which terminal is
-    ready, so we must signal them all !
-   */
-  for(int i=0;i<bios_serial_ports();i++) {
-    serial_dcb_t* dcb = &serial_dcb[i];
-    Cond_Broadcast(&dcb->rx_ready);
+/* Count an interrupt for each terminal in 'pending' */
+static void serial_count_irqs(uint32_t pending, int rx)
+{
+  for(; pending; pending &= pending-1) {
+    serial_route* r = &serial_routes[__builtin_ctz(pending)];
+    __atomic_add_fetch(rx ? &r->rx_irqs : &r->tx_irqs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&r->period_irqs, 1, __ATOMIC_RELAXED);
   }
-  if(pre) preempt_on;
 }
 
-/*
-  Read from the device, sleeping if needed.
- */
-int serial_read(void* dev, char *buf, unsigned int size)
+/* This is called by the bottom halves */
+static void serial_rebalance()
 {
-  serial_dcb_t* dcb = (serial_dcb_t*)dev;
+  uint ncores = cpu_cores();
+  uint nterm = bios_serial_ports();
+  if(ncores < 2 || nterm == 0) return;
+
+  /* Only one caller per period proceeds */
+  uint64_t now = bios_clock_ns();
+  uint64_t last = __atomic_load_n(&serial_balance_time, __ATOMIC_RELAXED);
+  if(now - last < SERIAL_BALANCE_PERIOD) return;
+  if(! __atomic_compare_exchange_n(&serial_balance_time, &last, now, 0, 
+      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    return;
+
+  unsigned long period[MAX_TERMINALS];
+  unsigned long load[MAX_CORES] = { 0 };
+  for(uint t=0; t<nterm; t++) {
+    period[t] = __atomic_exchange_n(&serial_routes[t].period_irqs, 0, __ATOMIC_RELAXED);
+    load[serial_routes[t].core] += period[t];
+  }
 
-  preempt_off;            /* Stop preemption */
+  /* The busiest core, and the least busy one, preferring idle cores */
+  uint src = 0, dst = 0;
+  for(uint c=1; c<ncores; c++) {
+    if(load[c] > load[src]) src = c;
+    if(load[c] < load[dst] || (load[c] == load[dst] && core_idle(c) && !core_idle(dst)))
+      dst = c;
+  }
 
-  uint count =  0;
+  /* An idle core keeps up with its interrupts */
+  if(core_idle(src) || load[src] - load[dst] < SERIAL_BALANCE_MIN) return;
 
-  while(count<size) {
-    int valid = bios_read_serial(dcb->devno, &buf[count]);
-    
-    if (valid) {
-      count++;
-    }
-    else if(count==0) {
-      kernel_wait(&dcb->rx_ready, SCHED_IO);
-    }
-    else
-      break;
+  /* Move the busiest terminal whose move reduces the imbalance */
+  int move = -1;
+  for(uint t=0; t<nterm; t++)
+    if(serial_routes[t].core == src && period[t] > 0 && period[t] < load[src] - load[dst]
+        && (move < 0 || period[t] > period[move]))
+      move = t;
+
+  if(move >= 0) {
+    serial_route_to(move, dst);
+    serial_routes[move].moves++;
   }
+}
 
-  preempt_on;           /* Restart preemption */
 
-  return count;
+size_t serial_sysinfo(void** info)
+{
+  uint nterm = bios_serial_ports();
+  serial_route_info* rec = xmalloc(nterm * sizeof(serial_route_info) + 1);
+
+  for(uint t=0; t<nterm; t++) {
+    serial_route* r = &serial_routes[t];
+    rec[t] = (serial_route_info) { 
+      .term = t, .core = r->core, 
+      .rx_interrupts = r->rx_irqs, .tx_interrupts = r->tx_irqs, .moves = r->moves 
+    };
+  }
+
+  *info = rec;
+  return nterm * sizeof(serial_route_info);
 }
 
 
 /*
-  A polling driver for serial writes
+  An interrupt-driven driver for serial writes.
+
+  Writers copy their data to the TX ring of the terminal, and block only 
+  when the ring is full. The ring is drained into the device by the writers
+  themselves, and by the bottom half of SERIAL_TX_READY, when the device 
+  can accept more data.
   */
 
+/*
+  Copy as many bytes as fit to the TX ring, and return their number.
+  This must be called with dcb->spinlock held.
+ */
+static unsigned int serial_tx_put(serial_dcb_t* dcb, const char* buf, unsigned int size)
+{
+  unsigned int count = 0;
+  while(count < size && dcb->tx_tail - dcb->tx_head < SERIAL_TX_RING) {
+    unsigned int pos = dcb->tx_tail & (SERIAL_TX_RING-1);
+    unsigned int len = SERIAL_TX_RING - (dcb->tx_tail - dcb->tx_head);
+    if(len > SERIAL_TX_RING - pos) len = SERIAL_TX_RING - pos;
+    if(len > size - count) len = size - count;
+
+    memcpy(&dcb->tx_ring[pos], &buf[count], len);
+    dcb->tx_tail += len;
+    count += len;
+  }
+  return count;
+}
+
+/*
+  Move bytes from the TX ring to the device, while it accepts them, and wake up
+  the threads waiting for room or for the ring to drain. Any push may be the one
+  that drains the ring, so every caller must broadcast; this is done here.
+  This must be called with dcb->spinlock held. Returns the number of bytes moved.
+ */
+static unsigned int serial_tx_push(serial_dcb_t* dcb)
+{
+  unsigned int moved = 0;
+  while(dcb->tx_head != dcb->tx_tail) {
+    unsigned int pos = dcb->tx_head & (SERIAL_TX_RING-1);
+    unsigned int len = dcb->tx_tail - dcb->tx_head;
+    if(len > SERIAL_TX_RING - pos) len = SERIAL_TX_RING - pos;
+
+    unsigned int n = bios_write_serial_buf(dcb->devno, &dcb->tx_ring[pos], len);
+    if(n == 0) break;
+    dcb->tx_head += n;
+    moved += n;
+  }
+  if(moved > 0)
+    Cond_Broadcast(&dcb->tx_ready);
+  return moved;
+}
+
+static void serial_tx_bottom(deferred_work* work)
+{
+  /* Drain the rings of the terminals that raised the interrupt */
+  uint32_t pending = __atomic_exchange_n(&serial_tx_pending, 0, __ATOMIC_ACQ_REL);
+  for(int i=0;i<bios_serial_ports();i++) {
+    if(! (pending & (1u<<i))) continue;
+    serial_dcb_t* dcb = &serial_dcb[i];
+    int pre = preempt_off;
+    Mutex_Lock(&dcb->spinlock);
+    serial_tx_push(dcb);
+    Mutex_Unlock(&dcb->spinlock);
+    if(pre) preempt_on;
+  }
+
+  serial_rebalance();
+}
+
 /* Interrupt driver */
 void serial_tx_handler()
 {
-  /* There is nothing to do */
+  int pre = preempt_off;
+  uint32_t pending = bios_serial_pending(SERIAL_TX_READY);
+  if(pending) {
+    serial_count_irqs(pending, 0);
+    __atomic_fetch_or(&serial_tx_pending, pending, __ATOMIC_ACQ_REL);
+    defer_work(&serial_tx_work);
+  }
+  if(pre) preempt_on;
+  defer_yield(pre);
 }
 
 /* 
   Write call 
-  This is currently a polling driver.
 */
 int serial_write(void* dev, const char* buf, unsigned int size)
 {
-  serial_dcb_t* dcb = (serial_dcb_t*)dev;
+  serial_dcb_t* dcb = ((serial_stream*)dev)->dcb;
+
+  /* We must not go into the non-preemptive domain with the kernel locked */
+  kernel_unlock();
+  preempt_off;
+  Mutex_Lock(&dcb->spinlock);
+
+  if(size > 0 && dcb->tx_tail - dcb->tx_head == SERIAL_TX_RING) {
+    uint64_t start = bios_clock_ns();
+    while(dcb->tx_tail - dcb->tx_head == SERIAL_TX_RING)
+      Cond_Wait(&dcb->spinlock, &dcb->tx_ready);
+    account_wait(cur_thread(), start);
+  }
 
-  unsigned int count = 0;
-  while(count < size) {
-    int success = bios_write_serial(dcb->devno, buf[count] );
-
-    if(success) {
-      count++;
-    } 
-    else if(count==0)
-    {
-      yield(SCHED_IO);
+  unsigned int count = serial_tx_put(dcb, buf, size);
+  ((serial_stream*)dev)->tx_mark = dcb->tx_tail;
+  serial_tx_push(dcb);
+
+  Mutex_Unlock(&dcb->spinlock);
+  preempt_on;
+  kernel_lock();
+
+  return count;  
+}
+
+
+/*
+  Interrupt-driven driver for serial-device reads, with a line discipline.
+
+  Received bytes are moved from the device to the RX ring of the terminal by 
+  the bottom half of SERIAL_RX_READY, and by the readers, as long as there is 
+  room in the ring. On the way, the line discipline processes them: in 
+  canonical mode, the bytes after rx_line form the line being edited, which
+  becomes readable when a newline or CHAR_EOF is received. CHAR_EOF is kept
+  in the ring, as the end of its line.
+ */
+
+/* Echo to the console, if there is room; echo is dropped otherwise */
+static inline void serial_echo(serial_dcb_t* dcb, const char* s, unsigned int n)
+{
+  if(dcb->mode & TERM_ECHO)
+    serial_tx_put(dcb, s, n);
+}
+
+/*
+  Pass a received byte through the line discipline.
+  This must be called with dcb->spinlock held, and room in the ring.
+ */
+static void serial_rx_input(serial_dcb_t* dcb, char c)
+{
+  if(dcb->mode & TERM_CANON) {
+    if(c == '\r') c = '\n';
+
+    if(c == CHAR_BS || c == CHAR_DEL || c == CHAR_KILL) {
+      while(dcb->rx_tail != dcb->rx_line) {
+        dcb->rx_tail--;
+        serial_echo(dcb, "\b \b", 3);
+        if(c != CHAR_KILL) break;
+      }
+      return;
     }
-    else
-      break;
+
+    dcb->rx_ring[dcb->rx_tail++ & (SERIAL_RX_RING-1)] = c;
+    if(c != CHAR_EOF) serial_echo(dcb, &c, 1);
+
+    /* A full ring ends the line, else the readers would wait for ever */
+    if(c == '\n' || c == CHAR_EOF || dcb->rx_tail - dcb->rx_head == SERIAL_RX_RING)
+      dcb->rx_line = dcb->rx_tail;
+  }
+  else {
+    dcb->rx_ring[dcb->rx_tail++ & (SERIAL_RX_RING-1)] = c;
+    dcb->rx_line = dcb->rx_tail;
+    serial_echo(dcb, &c, 1);
   }
+}
 
-  return count;  
+/*
+  Move bytes from the device to the RX ring, while there is room.
+  This must be called with dcb->spinlock held. Returns 1 if new bytes
+  became readable.
+ */
+static int serial_rx_pull(serial_dcb_t* dcb)
+{
+  unsigned int line = dcb->rx_line;
+  unsigned int room;
+  while((room = SERIAL_RX_RING - (dcb->rx_tail - dcb->rx_head)) > 0) {
+    char buf[256];
+    unsigned int n = bios_read_serial_buf(dcb->devno, buf, (room < sizeof(buf)) ? room : sizeof(buf));
+    if(n == 0) break;
+    for(unsigned int i=0; i<n; i++)
+      serial_rx_input(dcb, buf[i]);
+  }
+  serial_tx_push(dcb);
+  return dcb->rx_line != line;
+}
+
+static void serial_rx_bottom(deferred_work* work)
+{
+  /* Wake up the readers of the terminals that raised the interrupt */
+  uint32_t pending = __atomic_exchange_n(&serial_rx_pending, 0, __ATOMIC_ACQ_REL);
+  for(int i=0;i<bios_serial_ports();i++) {
+    if(! (pending & (1u<<i))) continue;
+    serial_dcb_t* dcb = &serial_dcb[i];
+    int pre = preempt_off;
+    Mutex_Lock(&dcb->spinlock);
+    int ready = serial_rx_pull(dcb);
+    Mutex_Unlock(&dcb->spinlock);
+    if(pre) preempt_on;
+
+    if(ready)
+      Cond_Broadcast(&dcb->rx_ready);
+  }
+
+  serial_rebalance();
 }
 
+void serial_rx_handler()
+{
+  int pre = preempt_off;
+  uint32_t pending = bios_serial_pending(SERIAL_RX_READY);
+  if(pending) {
+    serial_count_irqs(pending, 1);
+    __atomic_fetch_or(&serial_rx_pending, pending, __ATOMIC_ACQ_REL);
+    defer_work(&serial_rx_work);
+  }
+  if(pre) preempt_on;
+  defer_yield(pre);
+}
 
+/*
+  Read from the device, sleeping if needed. In canonical mode, at most one
+  line is returned, and 0 is returned at CHAR_EOF.
+ */
+int serial_read(void* dev, char *buf, unsigned int size)
+{
+  serial_dcb_t* dcb = ((serial_stream*)dev)->dcb;
+  if(size == 0) return 0;
+
+  /* We must not go into the non-preemptive domain with the kernel locked */
+  kernel_unlock();
+  preempt_off;
+  Mutex_Lock(&dcb->spinlock);
+
+  serial_rx_pull(dcb);
+  if(dcb->rx_head == dcb->rx_line) {
+    uint64_t start = bios_clock_ns();
+    while(dcb->rx_head == dcb->rx_line) {
+      Cond_Wait(&dcb->spinlock, &dcb->rx_ready);
+      serial_rx_pull(dcb);
+    }
+    account_wait(cur_thread(), start);
+  }
+
+  int canon = dcb->mode & TERM_CANON;
+  uint count = 0;
+  while(count < size && dcb->rx_head != dcb->rx_line) {
+    char c = dcb->rx_ring[dcb->rx_head++ & (SERIAL_RX_RING-1)];
+    if(canon && c == CHAR_EOF) break;
+    buf[count++] = c;
+    if(canon && c == '\n') break;
+  }
+
+  /* We made room, so more may be pulled from the device */
+  serial_rx_pull(dcb);
+
+  Mutex_Unlock(&dcb->spinlock);
+  preempt_on;
+  kernel_lock();
+
+  return count;
+}
+
+
+int serial_mode(file_ops* ops, void* dev, int mode)
+{
+  if(ops->Read != serial_read) return -1;
+  if(mode < -1 || mode > (TERM_CANON|TERM_ECHO)) return -1;
+  serial_dcb_t* dcb = ((serial_stream*)dev)->dcb;
+
+  int pre = preempt_off;
+  Mutex_Lock(&dcb->spinlock);
+  int old = dcb->mode;
+  int ready = 0;
+  if(mode != -1) {
+    dcb->mode = mode;
+    /* In raw mode, the line being edited is readable */
+    if(! (mode & TERM_CANON) && dcb->rx_line != dcb->rx_tail) {
+      dcb->rx_line = dcb->rx_tail;
+      ready = 1;
+    }
+  }
+  Mutex_Unlock(&dcb->spinlock);
+  if(pre) preempt_on;
+
+  if(ready)
+    Cond_Broadcast(&dcb->rx_ready);
+  return old;
+}
+
+
+/* Return true while the TX ring holds bytes queued before 'mark' */
+static inline int serial_tx_behind(serial_dcb_t* dcb, unsigned int mark)
+{
+  return dcb->tx_head != dcb->tx_tail && (int)(mark - dcb->tx_head) > 0;
+}
+
+/*
+  Closing a stream waits until its own output has been sent to the device.
+  The output of other streams queued after it is not waited for.
+ */
 int serial_close(void* dev) 
 {
+  serial_stream* s = dev;
+  serial_dcb_t* dcb = s->dcb;
+
+  kernel_unlock();
+  preempt_off;
+  Mutex_Lock(&dcb->spinlock);
+  if(serial_tx_behind(dcb, s->tx_mark)) {
+    uint64_t start = bios_clock_ns();
+    while(serial_tx_behind(dcb, s->tx_mark))
+      Cond_Wait(&dcb->spinlock, &dcb->tx_ready);
+    account_wait(cur_thread(), start);
+  }
+  Mutex_Unlock(&dcb->spinlock);
+  preempt_on;
+  kernel_lock();
+
+  free(s);
   return 0;
 }
 
@@ -171,7 +547,15 @@ int serial_close(void* dev)
 void* serial_open(uint term)
 {
   assert(term<bios_serial_ports());
-  return & serial_dcb[term];  
+  serial_stream* s = xmalloc(sizeof(serial_stream));
+  s->dcb = & serial_dcb[term];
+
+  int pre = preempt_off;
+  Mutex_Lock(&s->dcb->spinlock);
+  s->tx_mark = s->dcb->tx_head;   /* Nothing to wait for yet */
+  Mutex_Unlock(&s->dcb->spinlock);
+  if(pre) preempt_on;
+  return s;
 }
 
 
@@ -185,6 +569,312 @@ file_ops serial_fops = {
 
 
 
+/*============================================
+
+  The block device driver
+
+ ============================================*/
+
+
+/* 
+  The number of bios requests in flight per disk. Further requests 
+  wait in the elevator queue, where they are sorted and merged.
+ */
+#define BLK_MAX_INFLIGHT 2
+
+/* The maximum size of a merged request, in sectors */
+#define BLK_MAX_SECTORS 256
+
+/* A request by a kernel thread */
+typedef struct block_request {
+  disk_op op;
+  uint64_t sector;
+  uint nsectors;
+  void* buf;
+  int status;
+  int done;
+  rlnode node;          /* in the elevator queue, or in a batch */
+} blk_request;
+
+/* A bios request, made by merging one or more blk_requests */
+typedef struct block_batch {
+  disk_request req;     /* must be first */
+  rlnode members;
+  int busy;
+} blk_batch;
+
+typedef struct block_device_control_block {
+  uint devno;
+  uint64_t nsectors;
+  Mutex spinlock;       /* Protects the following. Taken with preemption off. */
+  rlnode queue;         /* The elevator queue, sorted by sector */
+  uint64_t head;        /* The sector after the last dispatched request */
+  blk_batch batch[BLK_MAX_INFLIGHT];
+  CondVar done;         /* Broadcast on every completion */
+} blk_dcb_t;
+
+blk_dcb_t blk_dcb[MAX_DISKS];
+
+/* The stream object of an open block device */
+typedef struct block_stream {
+  uint devno;
+  uint64_t pos;         /* The current sector */
+} blk_stream;
+
+
+/* Insert into the elevator queue, after requests with the same sector */
+static void blk_enqueue(blk_dcb_t* dcb, blk_request* r)
+{
+  rlnode* p = dcb->queue.prev;
+  while(p != &dcb->queue && ((blk_request*)p->obj)->sector > r->sector)
+    p = p->prev;
+  rl_splice(p, &r->node);
+}
+
+
+/*
+  Submit requests from the elevator queue to the disk, while there are 
+  free batches. The elevator is C-SCAN: the next request is the first
+  one at or after the disk head, wrapping around to the lowest sector.
+  Requests for contiguous sectors in the same direction are merged into
+  one bios request.
+ */
+static void blk_dispatch(blk_dcb_t* dcb)
+{
+  for(int i=0; i<BLK_MAX_INFLIGHT && !is_rlist_empty(&dcb->queue); i++) {
+    blk_batch* b = &dcb->batch[i];
+    if(b->busy) continue;
+
+    rlnode* p = dcb->queue.next;
+    while(p != &dcb->queue && ((blk_request*)p->obj)->sector < dcb->head)
+      p = p->next;
+    if(p == &dcb->queue) p = dcb->queue.next;
+
+    blk_request* r = p->obj;
+    b->req.op = r->op;
+    b->req.sector = r->sector;
+    b->req.nseg = 0;
+    uint total = 0;
+
+    while(1) {
+      rlnode* next = p->next;
+      rlist_push_back(&b->members, rlist_remove(p));
+      b->req.seg[b->req.nseg++] = (disk_segment){ .buf=r->buf, .nsectors=r->nsectors };
+      total += r->nsectors;
+
+      if(next == &dcb->queue || b->req.nseg == DISK_MAX_SEGMENTS) break;
+      blk_request* n = next->obj;
+      if(n->op != r->op || n->sector != r->sector + r->nsectors 
+        || total + n->nsectors > BLK_MAX_SECTORS) break;
+      p = next;
+      r = n;
+    }
+
+    dcb->head = r->sector + r->nsectors;
+    b->busy = 1;
+    if(bios_disk_submit(dcb->devno, &b->req) != 0) {
+      /* The requests were checked by blkdev_io, so this is a bug */
+      FATAL("The disk rejected a request");
+    }
+  }
+}
+
+
+/* The bottom half of blk_ready_handler */
+static deferred_work blk_ready_work;
+
+/*
+  Complete the finished requests of the disks and dispatch new ones.
+ */
+static void blk_ready_bottom(deferred_work* work)
+{
+  int pre = preempt_off;
+
+  /* We do not know which disk is ready, so we check them all */
+  for(int i=0; i<bios_disks(); i++) {
+    blk_dcb_t* dcb = &blk_dcb[i];
+    disk_request* req = bios_disk_completed(i);
+    if(req == NULL) continue;
+
+    Mutex_Lock(&dcb->spinlock);
+    for(; req != NULL; req = req->next) {
+      blk_batch* b = (blk_batch*) req;
+      while(! is_rlist_empty(&b->members)) {
+        blk_request* r = rlist_pop_front(&b->members)->obj;
+        r->status = req->status;
+        r->done = 1;
+      }
+      b->busy = 0;
+    }
+    blk_dispatch(dcb);
+    Mutex_Unlock(&dcb->spinlock);
+
+    Cond_Broadcast(&dcb->done);
+  }
+
+  if(pre) preempt_on;
+}
+
+/*
+  Interrupt handler for DISK_READY.
+ */
+void blk_ready_handler()
+{
+  int pre = preempt_off;
+  defer_work(&blk_ready_work);
+  if(pre) preempt_on;
+  defer_yield(pre);
+}
+
+
+uint64_t blkdev_sectors(uint minor)
+{
+  return (minor < device_no(DEV_BLOCK)) ? blk_dcb[minor].nsectors : 0;
+}
+
+
+int blkdev_io(uint minor, disk_op op, uint64_t sector, uint nsectors, void* buf)
+{
+  if(minor >= device_no(DEV_BLOCK)) return -1;
+  blk_dcb_t* dcb = &blk_dcb[minor];
+  if(nsectors == 0 || sector >= dcb->nsectors || nsectors > dcb->nsectors - sector)
+    return -1;
+
+  blk_request r = { .op=op, .sector=sector, .nsectors=nsectors, .buf=buf, .status=-1, .done=0 };
+  rlnode_init(&r.node, &r);
+
+  /* We must not go into the non-preemptive domain with the kernel locked */
+  kernel_unlock();
+  preempt_off;
+
+  TCB* self = cur_thread();
+  uint64_t start = bios_clock_ns();
+
+  Mutex_Lock(&dcb->spinlock);
+  blk_enqueue(dcb, &r);
+  blk_dispatch(dcb);
+  while(! r.done)
+    Cond_Wait(&dcb->spinlock, &dcb->done);
+  Mutex_Unlock(&dcb->spinlock);
+
+  account_wait(self, start);
+
+  preempt_on;
+  kernel_lock();
+
+  return r.status;
+}
+
+
+void* blkdev_open(uint minor)
+{
+  blk_stream* s = xmalloc(sizeof(blk_stream));
+  s->devno = minor;
+  s->pos = 0;
+  return s;
+}
+
+
+/*
+  Transfer whole sectors between a stream and the buffer cache.
+ */
+static int blkdev_transfer(blk_stream* s, char* buf, unsigned int size, disk_op op)
+{
+  uint64_t nsectors = blkdev_sectors(s->devno);
+
+  uint n = size / DISK_SECTOR_SIZE;
+  if(n == 0) return -1;
+  if(s->pos >= nsectors) return (op == DISK_OP_READ) ? 0 : -1;
+  if(n > nsectors - s->pos) n = nsectors - s->pos;
+
+  /* Advance the position before we block */
+  uint64_t sector = s->pos;
+  s->pos += n;
+
+  uint done = 0;
+  while(done < n) {
+    uint64_t block = (sector+done) / BCACHE_BLOCK_SECTORS;
+    uint offset = (sector+done) % BCACHE_BLOCK_SECTORS;
+    uint bsectors = bcache_block_sectors(s->devno, block);
+    uint count = bsectors - offset;
+    if(count > n - done) count = n - done;
+
+    /* A write of a whole block does not need to read it first */
+    bcache_buf* b = (op == DISK_OP_WRITE && count == bsectors) 
+      ? bget(s->devno, block) : bread(s->devno, block);
+    if(b == NULL) break;
+
+    char* bdata = b->data + offset*DISK_SECTOR_SIZE;
+    char* udata = buf + done*DISK_SECTOR_SIZE;
+    if(op == DISK_OP_READ)
+      memcpy(udata, bdata, count*DISK_SECTOR_SIZE);
+    else {
+      memcpy(bdata, udata, count*DISK_SECTOR_SIZE);
+      bdirty(b);
+    }
+    brelse(b);
+    done += count;
+  }
+
+  return (done > 0) ? done*DISK_SECTOR_SIZE : -1;
+}
+
+
+int blkdev_read(void* this, char* buf, unsigned int size)
+{
+  return blkdev_transfer(this, buf, size, DISK_OP_READ);
+}
+
+
+int blkdev_write(void* this, const char* buf, unsigned int size)
+{
+  return blkdev_transfer(this, (char*)buf, size, DISK_OP_WRITE);
+}
+
+
+static void blkdev_unmap(file_mapping* m)
+{
+  bunmap(m->obj);
+}
+
+
+int blkdev_mmap(void* this, uintptr_t offset, size_t len, file_mapping* m)
+{
+  blk_stream* s = this;
+  uint64_t block = offset / BCACHE_BLOCK_SIZE;
+  uint boffset = offset % BCACHE_BLOCK_SIZE;
+
+  if(block >= bcache_blocks(s->devno) 
+    || boffset + len > bcache_block_sectors(s->devno, block)*DISK_SECTOR_SIZE)
+    return -1;
+
+  bcache_buf* b = bmap(s->devno, block);
+  if(b == NULL) return -1;
+
+  m->addr = b->data + boffset;
+  m->unmap = blkdev_unmap;
+  m->obj = b;
+  return 0;
+}
+
+
+int blkdev_close(void* this)
+{
+  free(this);
+  return 0;
+}
+
+
+file_ops blkdev_fops = {
+  .Open = blkdev_open,
+  .Read = blkdev_read,
+  .Write = blkdev_write,
+  .Close = blkdev_close,
+  .MMap = blkdev_mmap
+};
+
+
+
 /***********************************
 
   The device table
@@ -193,6 +883,10 @@ file_ops serial_fops = {
 
 DCB devtable[DEV_MAX];
 
+static dev_stats null_stats[1];
+static dev_stats serial_stats[MAX_TERMINALS];
+static dev_stats blk_stats[MAX_DISKS];
+
 
 
 void initialize_devices()
@@ -201,20 +895,62 @@ void initialize_devices()
   devtable[DEV_NULL].type = DEV_NULL;
   devtable[DEV_NULL].devnum = 1;
   devtable[DEV_NULL].dev_fops = nulldev_fops;
+  devtable[DEV_NULL].stats = null_stats;
 
   devtable[DEV_SERIAL].type = DEV_SERIAL;
   devtable[DEV_SERIAL].devnum = bios_serial_ports();
   devtable[DEV_SERIAL].dev_fops = serial_fops;
+  devtable[DEV_SERIAL].stats = serial_stats;
+
+  devtable[DEV_BLOCK].type = DEV_BLOCK;
+  devtable[DEV_BLOCK].devnum = bios_disks();
+  devtable[DEV_BLOCK].dev_fops = blkdev_fops;
+  devtable[DEV_BLOCK].stats = blk_stats;
+
+  for(int d=0; d<DEV_MAX; d++)
+    memset(devtable[d].stats, 0, devtable[d].devnum * sizeof(dev_stats));
 
   /* Initialize the serial devices */
   for(int i=0; i<bios_serial_ports(); i++) {
     serial_dcb[i].devno = i;
     serial_dcb[i].rx_ready = COND_INIT;
+    serial_dcb[i].tx_ready = COND_INIT;
+    serial_dcb[i].tx_head = serial_dcb[i].tx_tail = 0;
+    serial_dcb[i].rx_head = serial_dcb[i].rx_line = serial_dcb[i].rx_tail = 0;
+    serial_dcb[i].mode = TERM_RAW;
     serial_dcb[i].spinlock = MUTEX_INIT;
   }
 
+  /* Initialize the block devices */
+  for(int i=0; i<bios_disks(); i++) {
+    blk_dcb_t* dcb = &blk_dcb[i];
+    dcb->devno = i;
+    dcb->nsectors = bios_disk_sectors(i);
+    dcb->spinlock = MUTEX_INIT;
+    rlnode_init(&dcb->queue, NULL);
+    dcb->head = 0;
+    for(int j=0; j<BLK_MAX_INFLIGHT; j++) {
+      rlnode_init(&dcb->batch[j].members, NULL);
+      dcb->batch[j].busy = 0;
+    }
+    dcb->done = COND_INIT;
+  }
+
+  serial_rx_pending = serial_tx_pending = 0;
+
+  /* Spread the terminals over the cores */
+  memset(serial_routes, 0, sizeof(serial_routes));
+  serial_balance_time = 0;
+  for(uint i=0; i<bios_serial_ports(); i++)
+    serial_route_to(i, i % cpu_cores());
+
+  defer_init(&serial_rx_work, serial_rx_bottom);
+  defer_init(&serial_tx_work, serial_tx_bottom);
+  defer_init(&blk_ready_work, blk_ready_bottom);
+
   cpu_interrupt_handler(SERIAL_RX_READY, serial_rx_handler);
   cpu_interrupt_handler(SERIAL_TX_READY, serial_tx_handler);
+  cpu_interrupt_handler(DISK_READY, blk_ready_handler);
 }
 
 
@@ -233,4 +969,25 @@ uint device_no(Device_type major)
   return devtable[major].devnum;
 }
 
+dev_stats* device_stats(Device_type major, uint minor)
+{
+  if(major >= DEV_MAX || minor >= devtable[major].devnum)
+    return NULL;
+  return & devtable[major].stats[minor];
+}
+
+void device_stats_sum(dev_stats* ds, io_stats* stats)
+{
+  *stats = (io_stats){ 0 };
+  for(int c=0; c<MAX_CORES; c++) {
+    io_stats* s = & ds->shard[c].s;
+    stats->reads += s->reads;
+    stats->writes += s->writes;
+    stats->bytes_read += s->bytes_read;
+    stats->bytes_written += s->bytes_written;
+    stats->waits += s->waits;
+    stats->wait_ns += s->wait_ns;
+  }
+}
+
 
@@ -9,6 +9,7 @@
 
 #include "util.h"
 #include "bios.h"
+#include "tinyos.h"
 
 /**
   @file kernel_dev.h
@@ -34,6 +35,20 @@
 */
 
 
+/**
+  @brief A memory mapping of a stream.
+
+  This is filled in by the @c MMap method of a stream. The mapped memory 
+  must stay valid, even after the stream is closed, until @c unmap is called.
+ */
+typedef struct file_mapping {
+  void* addr;                             /**< @brief The mapped memory */
+  void (*unmap)(struct file_mapping* m);  /**< @brief Release the mapping */
+  void* obj;                              /**< @brief Data of the stream for @c unmap */
+  rlnode mmap_node;                       /**< @brief Intrusive node for @c PCB::mmap_list */
+} file_mapping;
+
+
 /**
   @brief The device-specific file operations table.
 
@@ -92,6 +107,24 @@ typedef struct file_operations {
     - There was a I/O runtime problem.
      */
     int (*Close)(void* this);
+
+    /** @brief Seek operation.
+
+      Change the position of the stream 'this', as in @c Seek().
+      This function returns the new position, or -1 on error. 
+      Streams which do not support seeking set this to NULL.
+     */
+    intptr_t (*Seek)(void* this, intptr_t offset, seek_whence whence);
+
+    /** @brief Memory map operation.
+
+      Map bytes @c offset to @c offset+len-1 of the stream 'this', as in 
+      @c MMap(), filling in @c m->addr, @c m->unmap and @c m->obj.
+      The range has been checked not to cross a page.
+      This function returns 0 on success, or -1 on error.
+      Streams which do not support mapping set this to NULL.
+     */
+    int (*MMap)(void* this, uintptr_t offset, size_t len, file_mapping* m);
 } file_ops;
 
 
@@ -104,10 +137,24 @@ typedef struct file_operations {
 typedef enum { 
 	DEV_NULL,    /**< @brief Null device */
 	DEV_SERIAL,  /**< @brief Serial device */
+	DEV_BLOCK,   /**< @brief Block device (disk) */
 	DEV_MAX      /**< @brief placeholder for maximum device number */
 }  Device_type;
 
 
+/**
+  @brief The I/O statistics of a device.
+
+  The counters are sharded per core, so that cores doing I/O on the 
+  same device do not contend for the same cache line.
+*/
+typedef struct device_stats {
+  struct {
+    _Alignas(64) io_stats s;
+  } shard[MAX_CORES];     /**< @brief The counters of each core */
+} dev_stats;
+
+
 /**
   @brief Device control block.
 
@@ -126,6 +173,8 @@ typedef struct device_control_block
   file_ops dev_fops;	/**< @brief Device operations
 
   							This structure is provided by the device driver. */
+
+  dev_stats* stats;     /**< @brief The statistics of each device (of size @c devnum) */
 } DCB;
 
 
@@ -156,6 +205,63 @@ int device_open(Device_type major, uint minor, void** obj, file_ops** ops);
   */
 uint device_no(Device_type major);
 
+/**
+  @brief Get the statistics counters of a device.
+
+  @returns the counters, or NULL if the device does not exist
+  */
+dev_stats* device_stats(Device_type major, uint minor);
+
+/**
+  @brief Sum the per-core counters of a device.
+  */
+void device_stats_sum(dev_stats* ds, io_stats* stats);
+
+
+/**
+  @brief Get or set the line discipline mode of a terminal.
+
+  This implements @c TermMode for the stream @c dev with operations @c ops.
+  @returns the previous mode, or -1 if the stream is not a terminal or
+    the mode is not valid
+  */
+int serial_mode(file_ops* ops, void* dev, int mode);
+
+/**
+  @brief Return the interrupt routing of the terminals, as an array of 
+  @c serial_route_info.
+
+  The array is allocated by @c xmalloc and must be freed by the caller.
+  @returns the size of the array in bytes
+  */
+size_t serial_sysinfo(void** info);
+
+
+/**
+  @brief Synchronous I/O on a block device.
+
+  Transfer @c nsectors sectors, starting at @c sector, between block
+  device @c minor and @c buf. The request is queued to the device's
+  elevator, where it may be merged with other requests for adjacent
+  sectors, and the calling thread blocks until it is complete.
+
+  This must be called with the kernel lock held; the lock is released
+  while the thread waits.
+
+  @param minor the block device
+  @param op the direction of the transfer
+  @param sector the first sector
+  @param nsectors the number of sectors
+  @param buf the memory buffer, of size at least @c nsectors*DISK_SECTOR_SIZE
+  @returns 0 on success, -1 on error.
+  */
+int blkdev_io(uint minor, disk_op op, uint64_t sector, uint nsectors, void* buf);
+
+/**
+  @brief Return the number of sectors of a block device.
+  */
+uint64_t blkdev_sectors(uint minor);
+
 /** @} */
 
 #endif
@@ -0,0 +1,115 @@
+
+#include <assert.h>
+#include "tinyos.h"
+#include "kernel_sched.h"
+#include "kernel_futex.h"
+
+
+/**
+	@file kernel_futex.c
+
+	@brief Futexes: sleeping on a user address.
+
+	Waiters are kept in a hashed table of wait queues, keyed by address.
+	Each bucket is protected by its own spinlock, so the futex calls do
+	not take the kernel lock. As with condition variables, a waiter is 
+	put to sleep atomically with the release of its bucket lock, so a 
+	wakeup cannot be lost.
+  */
+
+
+/* The number of buckets of the wait queue table (a power of 2) */
+#define FUTEX_BUCKETS 256
+
+
+typedef struct futex_waiter
+{
+	rlnode node;			/* Intrusive node for the bucket list */
+	int* addr;				/* The address waited on */
+	TCB* thread;			/* The waiting thread */
+	int woken;				/* Set if woken by FutexWake */
+	int removed;			/* Set if removed from the bucket */
+} futex_waiter;
+
+
+typedef struct futex_bucket
+{
+	Mutex lock;
+	rlnode waiters;
+} futex_bucket;
+
+
+static futex_bucket futex_table[FUTEX_BUCKETS];
+
+
+void initialize_futexes()
+{
+	for(int i=0; i<FUTEX_BUCKETS; i++) {
+		futex_table[i].lock = MUTEX_INIT;
+		rlnode_init(& futex_table[i].waiters, NULL);
+	}
+}
+
+
+static inline futex_bucket* futex_hash(int* addr)
+{
+	uintptr_t h = (uintptr_t) addr >> 2;
+	h *= 0x9E3779B97F4A7C15ull;
+	return & futex_table[(h >> 32) & (FUTEX_BUCKETS-1)];
+}
+
+
+int sys_FutexWait(int* addr, int expected, timeout_t timeout)
+{
+	if(addr == NULL) return -1;
+
+	futex_bucket* b = futex_hash(addr);
+	futex_waiter w = { .addr = addr, .thread = cur_thread(), .woken = 0, .removed = 0 };
+	rlnode_init(& w.node, &w);
+
+	Mutex_Lock(& b->lock);
+	if(__atomic_load_n(addr, __ATOMIC_SEQ_CST) != expected) {
+		Mutex_Unlock(& b->lock);
+		return -1;
+	}
+	rlist_push_back(& b->waiters, & w.node);
+
+	sleep_releasing(STOPPED, & b->lock, SCHED_USER, 
+		(timeout == FUTEX_NO_TIMEOUT) ? NO_TIMEOUT : timeout*1000ul);
+
+	/* If the timeout expired, we may still be in the bucket */
+	Mutex_Lock(& b->lock);
+	if(! w.removed)
+		rlist_remove(& w.node);
+	Mutex_Unlock(& b->lock);
+
+	return w.woken ? 0 : -1;
+}
+
+
+int sys_FutexWake(int* addr, unsigned int n)
+{
+	if(addr == NULL) return -1;
+
+	futex_bucket* b = futex_hash(addr);
+	int count = 0;
+
+	Mutex_Lock(& b->lock);
+	rlnode* p = b->waiters.next;
+	while(p != & b->waiters && count < n) {
+		futex_waiter* w = p->obj;
+		p = p->next;
+		if(w->addr != addr) continue;
+
+		rlist_remove(& w->node);
+		w->removed = 1;
+		/* A waiter whose timeout has expired is not counted */
+		if(wakeup(w->thread)) {
+			w->woken = 1;
+			count++;
+		}
+	}
+	Mutex_Unlock(& b->lock);
+
+	return count;
+}
@@ -0,0 +1,23 @@
+#ifndef __KERNEL_FUTEX_H
+#define __KERNEL_FUTEX_H
+
+#include "util.h"
+
+/**
+  @file kernel_futex.h
+  @brief Futexes.
+
+  The wait queues of @c FutexWait and @c FutexWake are kept in a hashed
+  table, which does not depend on the kernel lock.
+*/
+
+
+/**
+  @brief Initialize the futex wait queues.
+
+  This is called at boot.
+  */
+void initialize_futexes();
+
+
+#endif
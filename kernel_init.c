@@ -9,6 +9,12 @@
 #include "kernel_proc.h"
 #include "kernel_dev.h"
 #include "kernel_streams.h"
+#include "kernel_bcache.h"
+#include "kernel_ramfs.h"
+#include "kernel_sys.h"
+#include "kernel_futex.h"
+#include "kernel_defer.h"
+#include "kernel_shm.h"
 
 
 
@@ -36,9 +42,17 @@ void boot_tinyos_kernel()
   if(cpu_core_id==0) {
     /* Initialize the kenrel data structures */
     initialize_processes();
+    initialize_defer();
     initialize_devices();
     initialize_files();
+    initialize_bcache();
+    initialize_ramfs();
+    initialize_futexes();
+    initialize_shm();
     initialize_scheduler();
+#ifdef SYSCALL_PROFILE
+    syscall_profile_reset();
+#endif
 
     /* The boot task is executed normally! */
     if(Exec(boot_rec.init_task, boot_rec.argl, boot_rec.args)!=1)
@@ -55,6 +69,12 @@ void boot_tinyos_kernel()
 
   if(cpu_core_id==0) {
     /* Here, we could add cleanup after the scheduler has ended. */    
+    finalize_ramfs();
+    finalize_bcache();
+    finalize_files();
+#ifdef SYSCALL_PROFILE
+    syscall_profile_dump();
+#endif
   }
 }
 
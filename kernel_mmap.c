@@ -0,0 +1,63 @@
+
+#include "kernel_cc.h"
+#include "kernel_streams.h"
+#include "kernel_mmap.h"
+
+
+/**
+	@file kernel_mmap.c
+
+	@brief Memory mappings of files.
+  */
+
+
+void* sys_MMap(Fid_t fid, uintptr_t offset, size_t len)
+{
+	FCB* fcb = get_fcb(fid);
+	if(fcb == NULL || fcb->streamfunc->MMap == NULL)
+		return NULL;
+
+	/* The range must be inside one page */
+	if(len == 0 || len > MMAP_PAGE_SIZE - offset % MMAP_PAGE_SIZE)
+		return NULL;
+
+	file_mapping* m = xmalloc(sizeof(file_mapping));
+	if(fcb->streamfunc->MMap(fcb->streamobj, offset, len, m) != 0) {
+		free(m);
+		return NULL;
+	}
+
+	rlnode_init(& m->mmap_node, m);
+	rlist_push_back(& CURPROC->mmap_list, & m->mmap_node);
+	return m->addr;
+}
+
+
+static void mmap_release(file_mapping* m)
+{
+	rlist_remove(& m->mmap_node);
+	m->unmap(m);
+	free(m);
+}
+
+
+int sys_MUnmap(void* addr)
+{
+	rlnode* list = & CURPROC->mmap_list;
+	for(rlnode* p = list->next; p != list; p = p->next) {
+		file_mapping* m = p->obj;
+		if(m->addr == addr) {
+			mmap_release(m);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+
+void mmap_release_all(PCB* pcb)
+{
+	while(! is_rlist_empty(& pcb->mmap_list))
+		mmap_release(pcb->mmap_list.next->obj);
+}
+
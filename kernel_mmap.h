@@ -0,0 +1,25 @@
+#ifndef __KERNEL_MMAP_H
+#define __KERNEL_MMAP_H
+
+#include "util.h"
+#include "kernel_proc.h"
+
+/**
+  @file kernel_mmap.h
+  @brief Memory mappings of files.
+
+  Each process keeps a list of its memory mappings, in @c PCB::mmap_list. 
+  A mapping is created by the @c MMap method of a stream and it pins the 
+  mapped memory until it is released.
+*/
+
+
+/**
+  @brief Release all the memory mappings of a process.
+
+  This is called when a process exits.
+  */
+void mmap_release_all(PCB* pcb);
+
+
+#endif
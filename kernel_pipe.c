@@ -1,6 +1,7 @@
 #include "kernel_streams.h"
 #include "kernel_dev.h"
 #include "kernel_cc.h"
+#include "kernel_proc.h"
 
 static file_ops reader_file_ops = {
 	.Read = pipe_read,
@@ -94,17 +95,18 @@ int sys_Pipe(pipe_t* pipe){
     // setup the reader (fcbs[0] is the FCB at which fids[0] is pointing)
     fcbs[0]->streamfunc = &reader_file_ops;
     fcbs[0]->streamobj = pipe_obj;
-    // freelist node is already initiated by initialize_files() (kernel_streams.c line 21)
+    // freelist node is already initiated when the FCB slab is allocated (FCB_grow() in kernel_streams.c)
     // refcount is already incremented by FCB_reserve() (kernel_streams.c line 94)
     pipe_obj->reader = fcbs[0];
 
     // setup the writer (fcbs[1] is the FCB at which fids[1] is pointing)
     fcbs[1]->streamfunc = &writer_file_ops;
     fcbs[1]->streamobj = pipe_obj;
-    // freelist node is already initiated by initialize_files() (kernel_streams.c line 21)
+    // freelist node is already initiated when the FCB slab is allocated (FCB_grow() in kernel_streams.c)
     // refcount is already incremented by FCB_reserve() (kernel_streams.c line 94)
     pipe_obj->writer = fcbs[1];
 
+    CURPROC->rusage.pipes++;
     return 0;
 }
 
@@ -3,6 +3,7 @@
 #include "kernel_cc.h"
 #include "kernel_proc.h"
 #include "kernel_streams.h"
+#include "kernel_shm.h"
 
 
 /* 
@@ -19,9 +20,21 @@
 PCB PT[MAX_PROC];
 unsigned int process_count;
 
+/* 
+  PCBs are initialized lazily, on first allocation. The PCBs PT[0] to 
+  PT[pt_used-1] have been initialized; the rest are untouched since boot.
+ */
+static Pid_t pt_used;
+
+/* 
+  The used PCBs (alive or zombie), in order of creation. Info streams
+  keep their cursors in this list; a cursor is a node whose obj is NULL.
+ */
+static rlnode live_list;
+
 PCB* get_pcb(Pid_t pid)
 {
-  return PT[pid].pstate==FREE ? NULL : &PT[pid];
+  return (pid >= pt_used || PT[pid].pstate==FREE) ? NULL : &PT[pid];
 }
 
 Pid_t get_pid(PCB* pcb)
@@ -43,9 +56,17 @@ static inline void initialize_PCB(PCB* pcb)
   rlnode_init(& pcb->exited_list, NULL);
   rlnode_init(& pcb->children_node, pcb);
   rlnode_init(& pcb->exited_node, pcb);
-  //also initializing ptcb list
-  rlnode_init(& pcb->ptcb_list, NULL);
+  pcb->thread_table = NULL;
+  pcb->thread_table_size = 0;
+  pcb->thread_free = -1;
   pcb->thread_count = 0;
+  pcb->tls_keys = 0;
+  rlnode_init(& pcb->thread_cache, NULL);
+  pcb->thread_cache_size = 0;
+  rlnode_init(& pcb->shm_list, NULL);
+  rlnode_init(& pcb->mmap_list, NULL);
+  rlnode_init(& pcb->live_node, pcb);
+  pcb->pins = 0;
   pcb->child_exit = COND_INIT;
 }
 
@@ -54,19 +75,15 @@ static PCB* pcb_freelist;
 
 void initialize_processes()
 {
-  /* initialize the PCBs */
-  for(Pid_t p=0; p<MAX_PROC; p++) {
-    initialize_PCB(&PT[p]);
-  }
+  rlnode_init(& live_list, NULL);
 
-  /* use the parent field to build a free list */
-  PCB* pcbiter;
+  /* 
+    The PCBs are initialized by acquire_PCB, so boot time does not
+    depend on MAX_PROC. The free list (linked by the parent field) 
+    holds released PCBs.
+   */
+  pt_used = 0;
   pcb_freelist = NULL;
-  for(pcbiter = PT+MAX_PROC; pcbiter!=PT; ) {
-    --pcbiter;
-    pcbiter->parent = pcb_freelist;
-    pcb_freelist = pcbiter;
-  }
 
   process_count = 0;
 
@@ -83,11 +100,22 @@ PCB* acquire_PCB()
 {
   PCB* pcb = NULL;
 
+  if(pcb_freelist == NULL && pt_used < MAX_PROC) {
+    /* Extend the pool of initialized PCBs */
+    initialize_PCB(&PT[pt_used]);
+    PT[pt_used].parent = NULL;
+    pcb_freelist = &PT[pt_used++];
+  }
+
   if(pcb_freelist != NULL) {
     pcb = pcb_freelist;
     pcb->pstate = ALIVE;
+    pcb->rusage = (rusage_t){ 0 };
+    pcb->rusage_children = (rusage_t){ 0 };
+    pcb->io = (io_stats){ 0 };
     pcb_freelist = pcb_freelist->parent;
     process_count++;
+    rlist_push_back(& live_list, & pcb->live_node);
   }
 
   return pcb;
@@ -99,9 +127,30 @@ PCB* acquire_PCB()
 void release_PCB(PCB* pcb)
 {
   pcb->pstate = FREE;
-  pcb->parent = pcb_freelist;
-  pcb_freelist = pcb;
+  rlist_remove(& pcb->live_node);
   process_count--;
+
+  /* A pinned PCB is put on the free list by its last unpin */
+  if(pcb->pins == 0) {
+    pcb->parent = pcb_freelist;
+    pcb_freelist = pcb;
+  }
+}
+
+
+void pin_PCB(PCB* pcb)
+{
+  pcb->pins++;
+}
+
+
+void unpin_PCB(PCB* pcb)
+{
+  assert(pcb->pins > 0);
+  if(--pcb->pins == 0 && pcb->pstate == FREE) {
+    pcb->parent = pcb_freelist;
+    pcb_freelist = pcb;
+  }
 }
 
 
@@ -130,17 +179,51 @@ void start_main_thread()
 }
 
 
+/* The number of main threads woken up together by ExecMany */
+#define EXEC_MANY_BATCH 64
+
 /*
-	System call to create a new process.
+  The arguments of a process are kept in a reference-counted blob, 
+  so that processes created by ExecMany with the same arguments can
+  share one copy.
  */
-Pid_t sys_Exec(Task call, int argl, void* args)
+typedef struct exec_args {
+  unsigned int refcount;
+  max_align_t data[];
+} exec_args;
+
+static void* args_copy(int argl, void* args)
 {
-  PCB *curproc, *newproc;
-  
-  /* The new process PCB */
-  newproc = acquire_PCB();
+  exec_args* blob = xmalloc(sizeof(exec_args) + argl);
+  blob->refcount = 1;
+  memcpy(blob->data, args, argl);
+  return blob->data;
+}
 
-  if(newproc == NULL) goto finish;  /* We have run out of PIDs! */
+static void* args_share(void* args)
+{
+  exec_args* blob = (exec_args*)((char*)args - offsetof(exec_args, data));
+  blob->refcount++;
+  return args;
+}
+
+void release_args(void* args)
+{
+  if(args == NULL) return;
+  exec_args* blob = (exec_args*)((char*)args - offsetof(exec_args, data));
+  if(--blob->refcount == 0)
+    free(blob);
+}
+
+
+/*
+  Initialize a new process, which will execute call(argl, args),
+  with args already copied. The main thread is created, but it is
+  not woken up.
+ */
+static void exec_prepare(PCB* newproc, Task call, int argl, void* args)
+{
+  PCB *curproc;
 
   if(get_pid(newproc)<=1) {
     /* Processes with pid<=1 (the scheduler and the init process) 
@@ -162,82 +245,160 @@ Pid_t sys_Exec(Task call, int argl, void* args)
        if(newproc->FIDT[i])
           FCB_incref(newproc->FIDT[i]);
     }
+
+    /* Inherit shared memory attachments */
+    shm_inherit(newproc, curproc);
   }
 
 
   /* Set the main thread's function */
   newproc->main_task = call;
 
-  /* Copy the arguments to new storage, owned by the new process */
+  /* The arguments are owned by the new process */
   newproc->argl = argl;
-  if(args!=NULL) {
-    newproc->args = malloc(argl);
-    memcpy(newproc->args, args, argl);
-  }
-  else
-    newproc->args=NULL;
+  newproc->args = args;
 
   /* 
-    Create and wake up the thread for the main function. This must be the last thing
-    we do, because once we wakeup the new thread it may run! so we need to have finished
-    the initialization of the PCB and PTCB
+    Create the thread for the main function. It is woken up by the caller, 
+    because once we wakeup the new thread it may run! so we need to have 
+    finished the initialization of the PCB and PTCB
    */
-  // ptcb allocation
-  
-  
-  /*
-  newproc->pstate = ALIVE;
-  newproc->exitval = 0;
-  rlnode_init(& newproc->children_list, NULL);
-  rlnode_init(& newproc->exited_list, NULL);
+  newproc->main_thread = NULL;
+  if(call != NULL) {
+    newproc->main_thread = spawn_thread(newproc, start_main_thread);
+    create_ptcb(newproc, newproc->main_thread, call, argl, args);
+  }
+}
 
-  rlnode_init(& newproc->children_node, newproc);
-  rlnode_init(& newproc->exited_node, newproc);
 
-  newproc->child_exit = COND_INIT;
+/*
+	System call to create a new process.
+ */
+Pid_t sys_Exec(Task call, int argl, void* args)
+{
+  /* The new process PCB */
+  PCB* newproc = acquire_PCB();
 
-  rlnode_init(& newproc->ptcb_list, NULL);
-  */
+  if(newproc == NULL) return NOPROC;  /* We have run out of PIDs! */
 
-  if(call != NULL) {
-    PTCB* newPTCB = (PTCB*) xmalloc(sizeof(PTCB));
-    newproc->main_thread = spawn_thread(newproc, start_main_thread);
-    //additions
-
-    newproc->main_thread->ptcb=newPTCB;
-    newPTCB->tcb = newproc -> main_thread;
-    newPTCB->task = newproc->main_task;
-    newPTCB->argl = newproc->argl;
-    newPTCB->args = newproc->args;
-    //newPTCB -> exitval = 0;
-    newPTCB-> exited = 0;
-    newPTCB-> detached = 0;
-    newPTCB -> exit_cv = COND_INIT;
-    newPTCB -> refcount = 1;
-    rlnode_init(& newPTCB->ptcb_list_node, newPTCB);
-    rlist_push_back(&newproc->ptcb_list, &newPTCB->ptcb_list_node);
-    newproc->thread_count++;
+  exec_prepare(newproc, call, argl, (args!=NULL) ? args_copy(argl, args) : NULL);
 
+  if(newproc->main_thread)
     wakeup(newproc->main_thread);
 
+  return get_pid(newproc);
+}
+
+
+/*
+	System call to create many processes at once.
+ */
+int sys_ExecMany(Task call, unsigned int n, int argl, void* const* args, Pid_t* pids)
+{
+  if(call == NULL || argl < 0) return -1;
+
+  TCB* threads[EXEC_MANY_BATCH];
+  unsigned int count = 0;
+  unsigned int batch = 0;
+  void* prev = NULL;   /* The copy of the arguments of the previous process */
+
+  for(; count < n; count++) {
+    PCB* newproc = acquire_PCB();
+    if(newproc == NULL) break;
+
+    void* a = NULL;
+    if(args != NULL && args[count] != NULL) {
+      /* Processes with the same arguments as the previous one share them */
+      if(count > 0 && args[count] == args[count-1] && prev != NULL)
+        a = args_share(prev);
+      else
+        a = args_copy(argl, args[count]);
+    }
+    prev = a;
+
+    exec_prepare(newproc, call, argl, a);
+    if(pids) pids[count] = get_pid(newproc);
+
+    threads[batch++] = newproc->main_thread;
+    if(batch == EXEC_MANY_BATCH) {
+      wakeup_many(threads, batch);
+      batch = 0;
+    }
   }
 
+  wakeup_many(threads, batch);
 
-finish:
-  return get_pid(newproc);
+  if(pids)
+    for(unsigned int i = count; i < n; i++) pids[i] = NOPROC;
+
+  return count;
 }
 
 
 /* System call */
 Pid_t sys_GetPid()
 {
-  return get_pid(CURPROC);
+  return cur_thread()->vdso.pid;
 }
 
 
 Pid_t sys_GetPPid()
 {
-  return get_pid(CURPROC->parent);
+  /* This is not locked; the parent may exit and reparent us to init */
+  return get_pid(__atomic_load_n(& CURPROC->parent, __ATOMIC_ACQUIRE));
+}
+
+
+static void rusage_add(rusage_t* to, const rusage_t* from)
+{
+  to->cpu_ns += from->cpu_ns;
+  to->vol_switches += from->vol_switches;
+  to->invol_switches += from->invol_switches;
+  to->reads += from->reads;
+  to->writes += from->writes;
+  to->bytes_read += from->bytes_read;
+  to->bytes_written += from->bytes_written;
+  to->pipes += from->pipes;
+  to->sockets += from->sockets;
+  to->threads += from->threads;
+  if(from->peak_threads > to->peak_threads)
+    to->peak_threads = from->peak_threads;
+}
+
+
+void rusage_thread_exit(PCB* pcb, TCB* tcb)
+{
+  pcb->rusage.cpu_ns += tcb->cpu_ns;
+  pcb->rusage.vol_switches += tcb->vol_switches;
+  pcb->rusage.invol_switches += tcb->invol_switches;
+}
+
+
+int sys_GetRUsage(Pid_t pid, rusage_t* usage)
+{
+  PCB* curproc = CURPROC;
+  if(usage == NULL) return -1;
+
+  if(pid == RUSAGE_CHILDREN) {
+    *usage = curproc->rusage_children;
+    return 0;
+  }
+
+  PCB* pcb = (pid == RUSAGE_SELF) ? curproc : get_pcb(pid);
+  if(pcb == NULL || pcb->pstate == FREE) return -1;
+
+  /* Exited threads are already accounted for */
+  *usage = pcb->rusage;
+  TCB** live = xmalloc(pcb->thread_table_size * sizeof(TCB*) + 1);
+  unsigned int n = 0;
+  for(unsigned int i=0; i<pcb->thread_table_size; i++) {
+    PTCB* ptcb = pcb->thread_table[i].ptcb;
+    if(ptcb && ! ptcb->exited)
+      live[n++] = ptcb->tcb;
+  }
+  sched_thread_usage(live, n, usage);
+  free(live);
+  return 0;
 }
 
 
@@ -249,6 +410,11 @@ static void cleanup_zombie(PCB* pcb, int* status)
   rlist_remove(& pcb->children_node);
   rlist_remove(& pcb->exited_node);
 
+  /* The parent inherits the usage of the child */
+  PCB* parent = CURPROC;
+  rusage_add(& parent->rusage_children, & pcb->rusage);
+  rusage_add(& parent->rusage_children, & pcb->rusage_children);
+
   release_PCB(pcb);
 }
 
@@ -349,8 +515,108 @@ void sys_Exit(int exitval)
 
 
 
+/*
+ *
+ * Process information streams
+ *
+ */
+
+/* The number of records copied in one batch, under the kernel lock */
+#define INFO_BATCH 16
+
+/*
+  An info stream is a cursor into the list of used PCBs. Since the cursor
+  is part of the list, the stream stays valid across Exec and Exit.
+ */
+typedef struct info_stream {
+  rlnode cursor;
+} info_stream;
+
+
+static void procinfo_snapshot(PCB* pcb, procinfo* info)
+{
+  info->pid = get_pid(pcb);
+  info->ppid = get_pid(pcb->parent);
+  info->alive = (pcb->pstate == ALIVE);
+  info->thread_count = pcb->thread_count;
+  info->main_task = pcb->main_task;
+  info->argl = pcb->argl;
+  info->io = pcb->io;
+
+  int n = (pcb->argl < PROCINFO_MAX_ARGS_SIZE) ? pcb->argl : PROCINFO_MAX_ARGS_SIZE;
+  if(pcb->args && n > 0) 
+    memcpy(info->args, pcb->args, n);
+}
+
+
+/*
+  Return as many whole procinfo records as fit in the buffer. Records are
+  taken in batches, and the kernel lock is released while each batch is
+  copied to the caller, so that long reads do not stall other processes.
+ */
+static int info_read(void* this, char* buf, unsigned int size)
+{
+  info_stream* s = this;
+  unsigned int count = 0;
+  unsigned int max = size / sizeof(procinfo);
+  if(max == 0) return -1;
+
+  procinfo batch[INFO_BATCH];
+  while(count < max) {
+    unsigned int n = 0;
+    rlnode* p = s->cursor.next;
+    while(n < INFO_BATCH && count+n < max && p != &live_list) {
+      if(p->pcb != NULL)    /* skip the cursors of other streams */
+        procinfo_snapshot(p->pcb, &batch[n++]);
+      p = p->next;
+    }
+
+    /* Move the cursor before p */
+    rlist_remove(& s->cursor);
+    rl_splice(p->prev, & s->cursor);
+
+    if(n == 0) break;
+
+    kernel_unlock();
+    memcpy(buf + count*sizeof(procinfo), batch, n*sizeof(procinfo));
+    kernel_lock();
+    count += n;
+  }
+
+  return count*sizeof(procinfo);
+}
+
+
+static int info_close(void* this)
+{
+  info_stream* s = this;
+  rlist_remove(& s->cursor);
+  free(s);
+  return 0;
+}
+
+
+static file_ops info_fops = {
+  .Open = NULL,
+  .Read = info_read,
+  .Write = NULL,
+  .Close = info_close
+};
+
+
 Fid_t sys_OpenInfo()
 {
-	return NOFILE;
+  Fid_t fid;
+  FCB* fcb;
+  if(! FCB_reserve(1, &fid, &fcb))
+    return NOFILE;
+
+  info_stream* s = xmalloc(sizeof(info_stream));
+  rlnode_init(& s->cursor, NULL);
+  rl_splice(& live_list, & s->cursor);
+
+  fcb->streamobj = s;
+  fcb->streamfunc = &info_fops;
+  return fid;
 }
 
@@ -30,6 +30,20 @@ typedef enum pid_state_e {
   ZOMBIE  /**< @brief The PID is held by a zombie */
 } pid_state;
 
+/**
+  @brief A slot of the thread handle table of a process.
+
+  A thread id encodes the index of a slot and the generation of the
+  slot, which is incremented whenever the slot is freed. Thus, a stale
+  thread id never refers to a newer thread.
+  */
+typedef struct thread_handle {
+  PTCB* ptcb;             /**< @brief The thread, or NULL for a free slot */
+  uint32_t gen;           /**< @brief The generation of the slot */
+  int next_free;          /**< @brief The next free slot, or -1 */
+} thread_handle;
+
+
 /**
   @brief Process Control Block.
 
@@ -60,8 +74,27 @@ typedef struct process_control_block {
 
   FCB* FIDT[MAX_FILEID];  /**< @brief The fileid table of the process */
 
-  rlnode ptcb_list;
-  int thread_count;
+  thread_handle* thread_table;  /**< @brief The thread handle table, indexed by Tid */
+  unsigned int thread_table_size;  /**< @brief The size of @c thread_table */
+  int thread_free;        /**< @brief Head of the free list of @c thread_table, or -1 */
+  int thread_count;       /**< @brief The number of live threads */
+
+  unsigned int tls_keys;  /**< @brief The bitmap of allocated thread-local storage keys */
+
+  rusage_t rusage;        /**< @brief The usage of the process, excluding live threads' CPU time and switches */
+  rusage_t rusage_children;  /**< @brief The usage of waited-for descendants */
+  io_stats io;            /**< @brief The I/O of the process, over all its streams */
+
+  rlnode thread_cache;    /**< @brief Thread blocks of joined threads, kept for reuse */
+  unsigned int thread_cache_size;  /**< @brief The length of @c thread_cache */
+
+  rlnode shm_list;        /**< @brief List of shared memory attachments */
+  rlnode mmap_list;       /**< @brief List of memory mappings of files */
+
+  rlnode live_node;       /**< @brief Intrusive node for the list of used PCBs */
+
+  unsigned int pins;      /**< @brief Holders that may still use this PCB after the
+                               process is reaped; the PCB is not reused while it is non-zero */
 
 } PCB;
 
@@ -98,6 +131,67 @@ PCB* get_pcb(Pid_t pid);
 */
 Pid_t get_pid(PCB* pcb);
 
+/**
+  @brief Release the arguments of a process.
+
+  The arguments of a process (@c PCB::args) may be shared with other
+  processes created by the same @c ExecMany, so they must be released 
+  by this function and not by @c free.
+*/
+void release_args(void* args);
+
+/**
+  @brief Create the PTCB of a new thread of a process.
+
+  The PTCB is entered in the thread table of @c pcb, which gives the thread 
+  its Tid, and the thread count of the process is increased.
+
+  @param pcb the process
+  @param tcb the new thread
+  @param task the function executed by the thread
+  @param argl the argument length of the thread
+  @param args the argument of the thread
+  @returns the new PTCB
+*/
+PTCB* create_ptcb(PCB* pcb, TCB* tcb, Task task, int argl, void* args);
+
+/**
+  @brief Create a new thread of a process.
+
+  This is like @c spawn_thread, but takes the thread block from the cache
+  of exited threads of @c pcb, when possible.
+*/
+TCB* spawn_process_thread(PCB* pcb, void (*func)());
+
+/**
+  @brief Pin a PCB, so that it is not reused.
+
+  A pinned PCB may be released (when its process is reaped), but it is not
+  reused until it is unpinned. The holder can tell that the process is gone
+  from its @c pstate, which is @c FREE.
+*/
+void pin_PCB(PCB* pcb);
+
+/**
+  @brief Drop a pin of a PCB, reusing the PCB if it was released.
+*/
+void unpin_PCB(PCB* pcb);
+
+/**
+  @brief Add the CPU time and context switches of an exiting thread to its process.
+
+  This is called by the scheduler, as the thread is switched out for the last
+  time, so that its usage outlives its TCB.
+*/
+void rusage_thread_exit(PCB* pcb, TCB* tcb);
+
+/**
+  @brief Find the PTCB of a thread of a process.
+
+  @returns the PTCB, or NULL if @c tid is not a thread of @c pcb.
+*/
+PTCB* get_ptcb(PCB* pcb, Tid_t tid);
+
 /** @} */
 
 #endif
@@ -0,0 +1,528 @@
+
+#include <assert.h>
+#include "kernel_cc.h"
+#include "kernel_streams.h"
+#include "kernel_ramfs.h"
+
+
+/**
+	@file kernel_ramfs.c
+
+	@brief The in-memory file system.
+  */
+
+
+/* A directory entry */
+typedef struct ramfs_dentry
+{
+	ramfs_inode* dir;				/* The directory containing the entry */
+	char name[MAX_NAME_LENGTH];
+	ramfs_inode* inode;
+	rlnode hash_node;
+} ramfs_dentry;
+
+
+/* An open file */
+typedef struct ramfs_stream
+{
+	ramfs_inode* inode;
+	int flags;
+	intptr_t pos;
+} ramfs_stream;
+
+
+static ramfs_inode* ramfs_root;
+static rlnode ramfs_inodes;			/* All inodes */
+static unsigned long ramfs_next_ino;
+
+/* The directory entry hash table. It doubles when it gets full. */
+static rlnode* dtable;
+static size_t dtable_size;
+static size_t dtable_count;
+
+#define DTABLE_INITIAL_SIZE 64
+
+
+/* FNV-1a of the name, mixed with the directory */
+static size_t dentry_hash(ramfs_inode* dir, const char* name)
+{
+	size_t h = 14695981039346656037ull ^ dir->ino;
+	for(; *name; name++) {
+		h ^= (unsigned char) *name;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static void dtable_init(size_t size)
+{
+	dtable = xmalloc(size * sizeof(rlnode));
+	dtable_size = size;
+	for(size_t i=0; i<size; i++)
+		rlnode_init(& dtable[i], NULL);
+}
+
+static void dtable_grow()
+{
+	rlnode* old = dtable;
+	size_t oldsize = dtable_size;
+
+	dtable_init(2*oldsize);
+	for(size_t i=0; i<oldsize; i++)
+		while(! is_rlist_empty(& old[i])) {
+			ramfs_dentry* d = rlist_pop_front(& old[i])->obj;
+			rlist_push_front(& dtable[dentry_hash(d->dir, d->name) & (dtable_size-1)], & d->hash_node);
+		}
+	free(old);
+}
+
+static ramfs_dentry* dentry_lookup(ramfs_inode* dir, const char* name)
+{
+	rlnode* bucket = & dtable[dentry_hash(dir, name) & (dtable_size-1)];
+	for(rlnode* p = bucket->next; p != bucket; p = p->next) {
+		ramfs_dentry* d = p->obj;
+		if(d->dir == dir && strcmp(d->name, name)==0) return d;
+	}
+	return NULL;
+}
+
+
+static ramfs_inode* inode_new(file_type type)
+{
+	ramfs_inode* inode = xmalloc(sizeof(ramfs_inode));
+	inode->ino = ramfs_next_ino++;
+	inode->type = type;
+	inode->nlink = 0;
+	inode->refcount = 0;
+	inode->mapped = 0;
+	inode->size = 0;
+	inode->parent = NULL;
+	inode->pages = NULL;
+	inode->npages = inode->maxpages = 0;
+	inode->readers = inode->writer = inode->wwaiting = 0;
+	inode->rwcv = COND_INIT;
+	rlnode_init(& inode->inode_node, inode);
+	rlist_push_back(& ramfs_inodes, & inode->inode_node);
+	return inode;
+}
+
+static void inode_free_pages(ramfs_inode* inode)
+{
+	for(size_t i=0; i<inode->npages; i++)
+		free(inode->pages[i]);
+	free(inode->pages);
+	inode->pages = NULL;
+	inode->npages = inode->maxpages = 0;
+}
+
+static void inode_free(ramfs_inode* inode)
+{
+	inode_free_pages(inode);
+	rlist_remove(& inode->inode_node);
+	free(inode);
+}
+
+/* Free an inode which is not reachable any more */
+static void inode_release(ramfs_inode* inode)
+{
+	if(inode->nlink == 0 && inode->refcount == 0)
+		inode_free(inode);
+}
+
+
+/*
+	Reader-writer locks, protected by the kernel lock. Writers have
+	priority, so that they are not starved by readers.
+ */
+static void rw_rlock(ramfs_inode* inode)
+{
+	while(inode->writer || inode->wwaiting)
+		kernel_wait(& inode->rwcv, SCHED_IO);
+	inode->readers++;
+}
+
+static void rw_runlock(ramfs_inode* inode)
+{
+	if(--inode->readers == 0)
+		kernel_broadcast(& inode->rwcv);
+}
+
+static void rw_wlock(ramfs_inode* inode)
+{
+	inode->wwaiting++;
+	while(inode->writer || inode->readers)
+		kernel_wait(& inode->rwcv, SCHED_IO);
+	inode->wwaiting--;
+	inode->writer = 1;
+}
+
+static void rw_wunlock(ramfs_inode* inode)
+{
+	inode->writer = 0;
+	kernel_broadcast(& inode->rwcv);
+}
+
+
+void initialize_ramfs()
+{
+	rlnode_init(& ramfs_inodes, NULL);
+	ramfs_next_ino = 1;
+	dtable_init(DTABLE_INITIAL_SIZE);
+	dtable_count = 0;
+
+	ramfs_root = inode_new(FILE_TYPE_DIR);
+	ramfs_root->parent = ramfs_root;
+	ramfs_root->nlink = 1;
+}
+
+
+void finalize_ramfs()
+{
+	for(size_t i=0; i<dtable_size; i++)
+		while(! is_rlist_empty(& dtable[i]))
+			free(rlist_pop_front(& dtable[i])->obj);
+	free(dtable);
+	dtable = NULL;
+
+	while(! is_rlist_empty(& ramfs_inodes))
+		inode_free(ramfs_inodes.next->obj);
+	ramfs_root = NULL;
+}
+
+
+/*
+	Path name resolution
+ */
+
+static ramfs_inode* ramfs_lookup(ramfs_inode* dir, const char* name)
+{
+	if(strcmp(name, ".")==0) return dir;
+	if(strcmp(name, "..")==0) return dir->parent;
+	ramfs_dentry* d = dentry_lookup(dir, name);
+	return d ? d->inode : NULL;
+}
+
+/*
+	Split a path name into its directory and its last name. The directory
+	is stored in *dir and the last name in name (or "" if the path
+	is the root). Returns 0 on success and -1 on error.
+ */
+static int ramfs_walk(const char* pathname, ramfs_inode** dir, char* name)
+{
+	if(pathname == NULL) return -1;
+	size_t len = strnlen(pathname, MAX_PATHNAME);
+	if(len == MAX_PATHNAME) return -1;
+
+	char path[MAX_PATHNAME];
+	memcpy(path, pathname, len+1);
+
+	ramfs_inode* cur = ramfs_root;
+	name[0] = '\0';
+
+	char* saveptr;
+	for(char* comp = strtok_r(path, "/", &saveptr); comp != NULL; comp = strtok_r(NULL, "/", &saveptr)) {
+		if(strlen(comp) >= MAX_NAME_LENGTH) return -1;
+
+		/* The previous name must be a directory */
+		if(name[0] != '\0') {
+			cur = ramfs_lookup(cur, name);
+			if(cur == NULL || cur->type != FILE_TYPE_DIR) return -1;
+		}
+		strcpy(name, comp);
+	}
+
+	*dir = cur;
+	return 0;
+}
+
+static ramfs_inode* ramfs_resolve(const char* pathname)
+{
+	ramfs_inode* dir;
+	char name[MAX_NAME_LENGTH];
+	if(ramfs_walk(pathname, &dir, name)) return NULL;
+	return (name[0] == '\0') ? dir : ramfs_lookup(dir, name);
+}
+
+static ramfs_inode* ramfs_create(ramfs_inode* dir, const char* name, file_type type)
+{
+	ramfs_inode* inode = inode_new(type);
+	if(type == FILE_TYPE_DIR) inode->parent = dir;
+
+	ramfs_dentry* d = xmalloc(sizeof(ramfs_dentry));
+	d->dir = dir;
+	strcpy(d->name, name);
+	d->inode = inode;
+	rlnode_init(& d->hash_node, d);
+
+	if(dtable_count >= dtable_size) dtable_grow();
+	rlist_push_front(& dtable[dentry_hash(dir, name) & (dtable_size-1)], & d->hash_node);
+	dtable_count++;
+
+	inode->nlink++;
+	dir->size++;
+	return inode;
+}
+
+
+/*
+	File contents
+ */
+
+/* Make sure that the pages covering [0, end) exist. Must hold the write lock. */
+static void ramfs_extend(ramfs_inode* inode, size_t end)
+{
+	size_t need = (end + RAMFS_PAGE_SIZE - 1) / RAMFS_PAGE_SIZE;
+	if(need <= inode->npages) return;
+
+	if(need > inode->maxpages) {
+		size_t newmax = inode->maxpages ? inode->maxpages : 4;
+		while(newmax < need) newmax *= 2;
+		inode->pages = realloc(inode->pages, newmax * sizeof(char*));
+		CHECK_CONDITION(inode->pages != NULL);
+		inode->maxpages = newmax;
+	}
+
+	/* New pages are zeroed, so holes read as zeros */
+	while(inode->npages < need) {
+		char* page = xmalloc(RAMFS_PAGE_SIZE);
+		memset(page, 0, RAMFS_PAGE_SIZE);
+		inode->pages[inode->npages++] = page;
+	}
+}
+
+/* Copy between a file and a buffer. Called without the kernel lock. */
+static void ramfs_copy(ramfs_inode* inode, size_t pos, char* buf, size_t n, int out)
+{
+	while(n > 0) {
+		char* page = inode->pages[pos / RAMFS_PAGE_SIZE];
+		size_t off = pos % RAMFS_PAGE_SIZE;
+		size_t chunk = RAMFS_PAGE_SIZE - off;
+		if(chunk > n) chunk = n;
+
+		if(out) 
+			memcpy(buf, page+off, chunk);
+		else
+			memcpy(page+off, buf, chunk);
+
+		pos += chunk;
+		buf += chunk;
+		n -= chunk;
+	}
+}
+
+
+static int ramfs_read(void* this, char* buf, unsigned int size)
+{
+	ramfs_stream* s = this;
+	ramfs_inode* inode = s->inode;
+	if(! (s->flags & OPEN_READ) || inode->type != FILE_TYPE_REGULAR)
+		return -1;
+
+	rw_rlock(inode);
+
+	size_t pos = s->pos;
+	size_t n = 0;
+	if(pos < inode->size) {
+		n = inode->size - pos;
+		if(n > size) n = size;
+	}
+	s->pos = pos + n;
+
+	kernel_unlock();
+	ramfs_copy(inode, pos, buf, n, 1);
+	kernel_lock();
+
+	rw_runlock(inode);
+	return n;
+}
+
+
+static int ramfs_write(void* this, const char* buf, unsigned int size)
+{
+	ramfs_stream* s = this;
+	ramfs_inode* inode = s->inode;
+	if(! (s->flags & OPEN_WRITE))
+		return -1;
+
+	rw_wlock(inode);
+
+	if(s->flags & OPEN_APPEND) 
+		s->pos = inode->size;
+
+	size_t pos = s->pos;
+	int ret = -1;
+	if(pos <= RAMFS_MAX_FILE_SIZE - size) {
+		ramfs_extend(inode, pos+size);
+
+		kernel_unlock();
+		ramfs_copy(inode, pos, (char*)buf, size, 0);
+		kernel_lock();
+
+		if(inode->size < pos+size) inode->size = pos+size;
+		s->pos = pos+size;
+		ret = size;
+	}
+
+	rw_wunlock(inode);
+	return ret;
+}
+
+
+static intptr_t ramfs_seek(void* this, intptr_t offset, seek_whence whence)
+{
+	ramfs_stream* s = this;
+	intptr_t base;
+	switch(whence) {
+		case SEEK_FROM_START: base = 0; break;
+		case SEEK_FROM_CURRENT: base = s->pos; break;
+		case SEEK_FROM_END: base = s->inode->size; break;
+		default: return -1;
+	}
+
+	if(offset < -base || base+offset > RAMFS_MAX_FILE_SIZE) return -1;
+	s->pos = base+offset;
+	return s->pos;
+}
+
+
+static void ramfs_unmap(file_mapping* m)
+{
+	ramfs_inode* inode = m->obj;
+	inode->mapped--;
+	inode->refcount--;
+	inode_release(inode);
+}
+
+
+static int ramfs_mmap(void* this, uintptr_t offset, size_t len, file_mapping* m)
+{
+	ramfs_stream* s = this;
+	ramfs_inode* inode = s->inode;
+	if(inode->type != FILE_TYPE_REGULAR || offset >= inode->size || len > inode->size - offset)
+		return -1;
+
+	inode->mapped++;
+	inode->refcount++;
+
+	m->addr = inode->pages[offset / RAMFS_PAGE_SIZE] + offset % RAMFS_PAGE_SIZE;
+	m->unmap = ramfs_unmap;
+	m->obj = inode;
+	return 0;
+}
+
+
+static int ramfs_close(void* this)
+{
+	ramfs_stream* s = this;
+	s->inode->refcount--;
+	inode_release(s->inode);
+	free(s);
+	return 0;
+}
+
+
+static file_ops ramfs_fops = {
+	.Open = NULL,
+	.Read = ramfs_read,
+	.Write = ramfs_write,
+	.Close = ramfs_close,
+	.Seek = ramfs_seek,
+	.MMap = ramfs_mmap
+};
+
+
+/*
+	System calls
+ */
+
+Fid_t sys_Open(const char* pathname, int flags)
+{
+	const int all_flags = OPEN_RDWR|OPEN_CREATE|OPEN_EXCL|OPEN_TRUNC|OPEN_APPEND;
+	if((flags & OPEN_RDWR)==0 || (flags & ~all_flags))
+		return NOFILE;
+
+	ramfs_inode* dir;
+	char name[MAX_NAME_LENGTH];
+	if(ramfs_walk(pathname, &dir, name)) return NOFILE;
+
+	ramfs_inode* inode = (name[0] == '\0') ? dir : ramfs_lookup(dir, name);
+	if(inode == NULL && !(flags & OPEN_CREATE)) return NOFILE;
+	if(inode != NULL && (flags & OPEN_CREATE) && (flags & OPEN_EXCL)) return NOFILE;
+	if(inode != NULL && inode->type == FILE_TYPE_DIR && (flags & ~OPEN_READ & ~OPEN_CREATE)) return NOFILE;
+	if(inode != NULL && inode->mapped && (flags & OPEN_TRUNC) && (flags & OPEN_WRITE)) return NOFILE;
+
+	Fid_t fid;
+	FCB* fcb;
+	if(! FCB_reserve(1, &fid, &fcb))
+		return NOFILE;
+
+	if(inode == NULL)
+		inode = ramfs_create(dir, name, FILE_TYPE_REGULAR);
+
+	ramfs_stream* s = xmalloc(sizeof(ramfs_stream));
+	s->inode = inode;
+	s->flags = flags;
+	s->pos = 0;
+	inode->refcount++;
+
+	fcb->streamobj = s;
+	fcb->streamfunc = &ramfs_fops;
+
+	if((flags & OPEN_TRUNC) && (flags & OPEN_WRITE)) {
+		rw_wlock(inode);
+		inode_free_pages(inode);
+		inode->size = 0;
+		rw_wunlock(inode);
+	}
+
+	return fid;
+}
+
+
+int sys_Stat(const char* pathname, stat_t* st)
+{
+	ramfs_inode* inode = ramfs_resolve(pathname);
+	if(inode == NULL || st == NULL) return -1;
+
+	st->ino = inode->ino;
+	st->type = inode->type;
+	st->nlink = inode->nlink;
+	st->size = inode->size;
+	return 0;
+}
+
+
+int sys_MkDir(const char* pathname)
+{
+	ramfs_inode* dir;
+	char name[MAX_NAME_LENGTH];
+	if(ramfs_walk(pathname, &dir, name)) return -1;
+	if(name[0] == '\0' || ramfs_lookup(dir, name) != NULL) return -1;
+
+	ramfs_create(dir, name, FILE_TYPE_DIR);
+	return 0;
+}
+
+
+int sys_Unlink(const char* pathname)
+{
+	ramfs_inode* dir;
+	char name[MAX_NAME_LENGTH];
+	if(ramfs_walk(pathname, &dir, name)) return -1;
+
+	ramfs_dentry* d = (name[0] == '\0') ? NULL : dentry_lookup(dir, name);
+	if(d == NULL) return -1;
+
+	ramfs_inode* inode = d->inode;
+	if(inode->type == FILE_TYPE_DIR && inode->size > 0) return -1;
+
+	rlist_remove(& d->hash_node);
+	dtable_count--;
+	free(d);
+
+	dir->size--;
+	inode->nlink--;
+	inode_release(inode);
+	return 0;
+}
+
@@ -0,0 +1,77 @@
+#ifndef __KERNEL_RAMFS_H
+#define __KERNEL_RAMFS_H
+
+#include "util.h"
+#include "tinyos.h"
+
+/**
+  @file kernel_ramfs.h
+  @brief The in-memory file system.
+
+  @defgroup ramfs Ramfs
+  @ingroup kernel
+  @brief The in-memory file system.
+
+  The directory tree is stored in a single hash table of directory entries,
+  keyed by (directory, name). The contents of a regular file are stored in
+  pages of size @c RAMFS_PAGE_SIZE, indexed by an extent table which grows by
+  doubling. Thus, a positional access locates its page in O(1) and an append 
+  costs amortized O(1).
+
+  Each file has a reader-writer lock. The data is copied with the kernel lock
+  released, so that readers of the same file (and accesses to different files) 
+  proceed concurrently.
+
+  A memory mapping points directly into a page. Pages are never moved, and
+  they are not freed while the file has mappings, since a mapped file
+  cannot be truncated.
+
+  @{
+*/
+
+/** @brief The size of a file page. Pages are mapped by @c MMap. */
+#define RAMFS_PAGE_SIZE MMAP_PAGE_SIZE
+
+/** @brief The maximum size of a file */
+#define RAMFS_MAX_FILE_SIZE (1ul<<30)
+
+
+/**
+  @brief An inode of the file system.
+  */
+typedef struct ramfs_inode {
+  unsigned long ino;            /**< @brief The inode number */
+  file_type type;               /**< @brief The type of the file */
+  unsigned int nlink;           /**< @brief The number of directory entries for this inode */
+  unsigned int refcount;        /**< @brief The number of open streams and memory mappings */
+  unsigned int mapped;          /**< @brief The number of memory mappings */
+  size_t size;                  /**< @brief File size, or number of directory entries */
+
+  struct ramfs_inode* parent;   /**< @brief The parent of a directory */
+
+  char** pages;                 /**< @brief The extent table */
+  size_t npages;                /**< @brief The number of pages allocated */
+  size_t maxpages;              /**< @brief The capacity of the extent table */
+
+  int readers;                  /**< @brief Number of readers holding the lock */
+  int writer;                   /**< @brief Set if a writer holds the lock */
+  int wwaiting;                 /**< @brief Number of writers waiting for the lock */
+  CondVar rwcv;                 /**< @brief Waiters for the lock */
+
+  rlnode inode_node;            /**< @brief Intrusive node for the list of all inodes */
+} ramfs_inode;
+
+
+/**
+  @brief Initialize the file system, creating an empty root directory.
+  */
+void initialize_ramfs();
+
+/**
+  @brief Release all the memory of the file system.
+  */
+void finalize_ramfs();
+
+/** @} */
+
+#endif
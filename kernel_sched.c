@@ -5,6 +5,7 @@
 #include "kernel_cc.h"
 #include "kernel_proc.h"
 #include "kernel_sched.h"
+#include "kernel_defer.h"
 #include "tinyos.h"
 
 #ifndef NVALGRIND
@@ -37,6 +38,11 @@ CCB cctx[MAX_CORES];
 #define CURTHREAD (CURCORE.current_thread)
 
 
+int core_idle(uint core)
+{
+	return cctx[core].current_thread == &cctx[core].idle_thread;
+}
+
 /*
 	This can be used in the preemptive context to
 	obtain the current thread.
@@ -80,7 +86,7 @@ TCB* cur_thread()
 
 /*
   A counter for active threads. By "active", we mean 'existing',
-  with the exception of idle threads (they don't count).
+  with the exception of idle threads and core workers (they don't count).
  */
 volatile unsigned int active_threads = 0;
 Mutex active_threads_spinlock = MUTEX_INIT;
@@ -150,13 +156,16 @@ static void thread_start()
   Initialize and return a new TCB
 */
 
-TCB* spawn_thread(PCB* pcb, void (*func)())
+TCB* spawn_thread_at(TCB* tcb, PCB* pcb, void (*func)())
 {
 	/* The allocated thread size must be a multiple of page size */
-	TCB* tcb = (TCB*)allocate_thread(THREAD_SIZE);
+	if (tcb == NULL)
+		tcb = (TCB*)allocate_thread(THREAD_SIZE);
 
 	/* Set the owner */
 	tcb->owner_pcb = pcb;
+	tcb->ptcb = NULL;
+	tcb->holds = 1;
 
 	/* Initialize the other attributes */
 	tcb->type = NORMAL_THREAD;
@@ -171,6 +180,15 @@ TCB* spawn_thread(PCB* pcb, void (*func)())
 	tcb->rts = QUANTUM;
 	tcb->last_cause = SCHED_IDLE;
 	tcb->curr_cause = SCHED_IDLE;
+	tcb->wait_count = 0;
+	tcb->wait_ns = 0;
+	tcb->cpu_ns = 0;
+	tcb->slice_start = 0;
+	tcb->vol_switches = 0;
+	tcb->invol_switches = 0;
+	for (int i = 0; i < MAX_TLS_KEYS; i++)
+		tcb->tls[i] = NULL;
+	tcb->vdso = (vdso_page){ .pid = get_pid(pcb), .tid = NOTHREAD, .clock_ns = bios_clock_ns };
 	// initialise the priority integer
 	tcb->priority = 0;
 	
@@ -192,6 +210,21 @@ TCB* spawn_thread(PCB* pcb, void (*func)())
 	return tcb;
 }
 
+TCB* spawn_thread(PCB* pcb, void (*func)())
+{
+	return spawn_thread_at(NULL, pcb, func);
+}
+
+int thread_block_put(TCB* tcb)
+{
+	return __atomic_sub_fetch(&tcb->holds, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+void free_thread_block(TCB* tcb)
+{
+	free_thread(tcb, THREAD_SIZE);
+}
+
 /*
   This is called with sched_spinlock locked !
  */
@@ -201,7 +234,9 @@ void release_TCB(TCB* tcb)
 	VALGRIND_STACK_DEREGISTER(tcb->valgrind_stack_id);
 #endif
 
-	free_thread(tcb, THREAD_SIZE);
+	/* The block may still be held, by the PTCB of the thread */
+	if (thread_block_put(tcb))
+		free_thread_block(tcb);
 
 	Mutex_Lock(&active_threads_spinlock);
 	active_threads--;
@@ -272,7 +307,11 @@ static void sched_register_timeout(TCB* tcb, TimerDuration timeout)
 static void sched_queue_add(TCB* tcb)
 {
 	assert(tcb->type!=IDLE_THREAD);
-	
+
+	/* The worker of a core is selected directly by its core, which is running,
+	   since the worker is only woken on it */
+	if (tcb->type == WORKER_THREAD)
+		return;
 	
 	assert(tcb->priority<PRIORITY_QUEUES);
 	assert(tcb ->priority>=0);
@@ -341,6 +380,15 @@ static TCB* sched_queue_select(TCB* current)
 	// rlnode* sel = rlist_pop_front(&SCHED); old implementation
 	rlnode* sel = NULL;
 	TCB* next_thread = NULL;
+
+	/* The worker of the core goes first, unless its quantum just expired */
+	TCB* worker = CURCORE.worker;
+	if (worker != NULL && worker->state == READY
+		&& !(worker == current && current->curr_cause == SCHED_QUANTUM)) {
+		worker->its = QUANTUM;
+		return worker;
+	}
+
 	// for each priority level
 	for(int i=0; i<PRIORITY_QUEUES; i++){
 		sel = rlist_pop_front(&SCHED[i]);
@@ -391,6 +439,57 @@ int wakeup(TCB* tcb)
 	return ret;
 }
 
+int wakeup_many(TCB** tcbs, unsigned int n)
+{
+	int ret = 0;
+	if(n == 0) return 0;
+
+	int oldpre = preempt_off;
+	Mutex_Lock(&sched_spinlock);
+
+	for(unsigned int i=0; i<n; i++)
+		if (tcbs[i]->state == STOPPED || tcbs[i]->state == INIT) {
+			sched_make_ready(tcbs[i]);
+			ret++;
+		}
+
+	Mutex_Unlock(&sched_spinlock);
+	if (oldpre)
+		preempt_on;
+
+	return ret;
+}
+
+/*
+  Charge the current time slice of a thread to it, and end the slice.
+  This must be called with sched_spinlock held.
+ */
+static void sched_close_slice(TCB* tcb)
+{
+	if (tcb->slice_start) {
+		tcb->cpu_ns += bios_clock_ns() - tcb->slice_start;
+		tcb->slice_start = 0;
+	}
+}
+
+void sched_thread_usage(TCB** threads, unsigned int n, rusage_t* usage)
+{
+	int preempt = preempt_off;
+	Mutex_Lock(&sched_spinlock);
+	uint64_t now = bios_clock_ns();
+	for (unsigned int i = 0; i < n; i++) {
+		TCB* tcb = threads[i];
+		usage->cpu_ns += tcb->cpu_ns;
+		if (tcb->slice_start)
+			usage->cpu_ns += now - tcb->slice_start;
+		usage->vol_switches += tcb->vol_switches;
+		usage->invol_switches += tcb->invol_switches;
+	}
+	Mutex_Unlock(&sched_spinlock);
+	if (preempt)
+		preempt_on;
+}
+
 /*
   Atomically put the current process to sleep, after unlocking mx.
  */
@@ -411,6 +510,17 @@ void sleep_releasing(Thread_state state, Mutex* mx, enum SCHED_CAUSE cause,
 	if (state != EXITED)
 		sched_register_timeout(tcb, timeout);
 
+	/* 
+	   Charge the last time slice and switch of an exiting thread to its 
+	   process now: once mx (the kernel lock) is released, the process may 
+	   be reaped.
+	 */
+	if (state == EXITED && tcb->ptcb != NULL) {
+		sched_close_slice(tcb);
+		tcb->vol_switches++;
+		rusage_thread_exit(tcb->owner_pcb, tcb);
+	}
+
 	/* Release mx */
 	if (mx != NULL)
 		Mutex_Unlock(mx);
@@ -488,6 +598,15 @@ void yield(enum SCHED_CAUSE cause)
 	/* Save the current TCB for the gain phase */
 	CURCORE.previous_thread = current;
 
+	/* Charge the time slice to the current thread */
+	if (current != next && current->state != EXITED) {
+		sched_close_slice(current);
+		if (cause == SCHED_QUANTUM || cause == SCHED_DEFER)
+			current->invol_switches++;
+		else
+			current->vol_switches++;
+	}
+
 	Mutex_Unlock(&sched_spinlock);
 
 	/* Switch contexts */
@@ -547,6 +666,7 @@ void gain(int preempt)
 	/* Take care of the previous thread */
 	TCB* prev = CURCORE.previous_thread;
 	if (current != prev) {
+		current->slice_start = bios_clock_ns();
 		prev->phase = CTX_CLEAN;
 		switch (prev->state) {
 		case READY:
@@ -589,6 +709,45 @@ static void idle_thread()
 	cpu_core_restart_all();
 }
 
+/*
+  Create the worker of the current core. The worker is not counted
+  in the active threads, so that it does not keep the scheduler running.
+ */
+static void start_core_worker(CCB* curcore)
+{
+	TCB* tcb = spawn_thread(get_pcb(0), defer_worker);
+	tcb->type = WORKER_THREAD;
+
+	Mutex_Lock(&active_threads_spinlock);
+	active_threads--;
+	Mutex_Unlock(&active_threads_spinlock);
+
+	int preempt = preempt_off;
+	curcore->worker = tcb;
+	if (preempt)
+		preempt_on;
+
+	wakeup(tcb);
+}
+
+/*
+  Release the worker of the current core, after the scheduler has stopped.
+  The worker is not running, but it may be in any other state.
+ */
+static void stop_core_worker(CCB* curcore)
+{
+	int preempt = preempt_off;
+	TCB* tcb = curcore->worker;
+	curcore->worker = NULL;
+	if (preempt)
+		preempt_on;
+
+#ifndef NVALGRIND
+	VALGRIND_STACK_DEREGISTER(tcb->valgrind_stack_id);
+#endif
+	free_thread_block(tcb);
+}
+
 /*
   Initialize the scheduler queue
  */
@@ -628,6 +787,9 @@ void run_scheduler()
 	cpu_interrupt_handler(ALARM, yield_handler);
 	cpu_interrupt_handler(ICI, ici_handler);
 
+	/* Start the worker of the core */
+	start_core_worker(curcore);
+
 	/* Run idle thread */
 	preempt_on;
 	idle_thread();
@@ -636,4 +798,5 @@ void run_scheduler()
 	assert(CURTHREAD == &CURCORE.idle_thread);
 	cpu_interrupt_handler(ALARM, NULL);
 	cpu_interrupt_handler(ICI, NULL);
+	stop_core_worker(curcore);
 }
@@ -72,7 +72,8 @@ typedef enum {
 /** @brief Thread type. */
 typedef enum {
 	IDLE_THREAD, /**< @brief Marks an idle thread. */
-	NORMAL_THREAD /**< @brief Marks a normal thread */
+	NORMAL_THREAD, /**< @brief Marks a normal thread */
+	WORKER_THREAD /**< @brief Marks the deferred-work thread of a core */
 } Thread_type;
 
 /**
@@ -88,9 +89,34 @@ enum SCHED_CAUSE {
 	SCHED_PIPE, /**< @brief Sleep at a pipe or socket */
 	SCHED_POLL, /**< @brief The thread is polling a device */
 	SCHED_IDLE, /**< @brief The idle thread called yield */
-	SCHED_USER /**< @brief User-space code called yield */
+	SCHED_USER, /**< @brief User-space code called yield */
+	SCHED_DEFER /**< @brief An interrupt handler yielded to the worker of the core */
 };
 
+/**
+  @brief The process thread control block
+
+  This holds the process-level state of a thread, i.e., what is needed to
+  join or detach it. It is stored inside the TCB of the thread.
+*/
+typedef struct process_thread_control_block {
+// variables from presentation
+	TCB* tcb; 
+  
+  Task task;
+  int argl;
+  void* args;
+
+  int exitval;
+
+  int exited;
+  int detached;
+  CondVar exit_cv;
+  int refcount;
+
+  Tid_t tid;      /**< @brief The handle of the thread in the thread table of its process */
+} PTCB;
+
 /**
   @brief The thread control block
 
@@ -100,7 +126,9 @@ enum SCHED_CAUSE {
 typedef struct thread_control_block {
 
 	PCB* owner_pcb; /**< @brief This is null for a free TCB */
-  PTCB* ptcb; /**< @brief */
+  PTCB* ptcb; /**< @brief The PTCB of a process thread, or NULL for a kernel thread */
+  PTCB ptcb_block; /**< @brief Storage for the PTCB of a process thread */
+  int holds; /**< @brief The holders of the thread block: the scheduler, and the PTCB if used */
   int priority; // process priority
 	cpu_context_t context; /**< @brief The thread context */
   Thread_type type; /**< @brief The type of thread */
@@ -118,6 +146,17 @@ typedef struct thread_control_block {
 	enum SCHED_CAUSE curr_cause; /**< @brief The endcause for the current time-slice */
 	enum SCHED_CAUSE last_cause; /**< @brief The endcause for the last time-slice */
 
+	void* tls[MAX_TLS_KEYS]; /**< @brief The thread-local storage slots */
+	vdso_page vdso; /**< @brief The page shared with the thread */
+
+	uint64_t cpu_ns; /**< @brief The CPU time of this thread, up to its last context switch */
+	uint64_t slice_start; /**< @brief The time this thread last gained a core, or 0 while it is off-core */
+	unsigned long vol_switches; /**< @brief Context switches where this thread gave up its core */
+	unsigned long invol_switches; /**< @brief Context switches where this thread was preempted */
+
+	unsigned long wait_count; /**< @brief The number of blocking waits of this thread */
+	uint64_t wait_ns; /**< @brief The total time this thread spent in blocking waits */
+
 #ifndef NVALGRIND
 	unsigned valgrind_stack_id; /**< @brief Valgrind helper for stacks. 
 
@@ -130,24 +169,6 @@ typedef struct thread_control_block {
 #endif
 
 } TCB;
-// we define ptcb unter the definition of tcb
-typedef struct process_thread_control_block {
-// variables from presentation
-	TCB* tcb; 
-  
-  Task task;
-  int argl;
-  void* args;
-
-  int exitval;
-
-  int exited;
-  int detached;
-  CondVar exit_cv;
-  int refcount;
-
-  rlnode ptcb_list_node;
-} PTCB;
 
 
 /** @brief Thread stack size.
@@ -172,12 +193,34 @@ typedef struct core_control_block {
 	TCB* current_thread; /**< @brief Points to the thread currently owning the core */
 	TCB* previous_thread; /**< @brief Points to the thread that previously owned the core */
 	TCB idle_thread; /**< @brief Used by the scheduler to handle the core's idle thread */
+	TCB* worker; /**< @brief The deferred-work thread of the core. 
+
+	  The worker only runs on this core, and it is not kept in the scheduler queue;
+	  when it is ready, it is selected ahead of any other thread.
+	  @see kernel_defer.h
+	  */
 
 } CCB;
 
 /** @brief the array of Core Control Blocks (CCB) for the kernel */
 extern CCB cctx[MAX_CORES];
 
+/**
+  @brief Return 1 if a core is running its idle thread, else 0.
+
+  This is a snapshot, which may be out of date by the time it returns.
+*/
+int core_idle(uint core);
+
+/**
+  @brief Add the CPU time and context switches of some threads to a usage record.
+
+  The counts of all the threads are taken in one snapshot, under the scheduler
+  lock. The CPU time includes the current time slice of the threads that are 
+  on a core.
+*/
+void sched_thread_usage(TCB** threads, unsigned int n, rusage_t* usage);
+
 
 /** 
   @brief The current thread.
@@ -192,6 +235,18 @@ extern CCB cctx[MAX_CORES];
 */
 TCB* cur_thread();
 
+/**
+  @brief Account for a blocking wait of a thread.
+
+  This adds one wait, of the time elapsed since @c start (as returned by
+  @c bios_clock_ns), to the wait statistics of @c tcb.
+*/
+static inline void account_wait(TCB* tcb, uint64_t start)
+{
+  tcb->wait_count++;
+  tcb->wait_ns += bios_clock_ns() - start;
+}
+
 #define MAX_YIELDS 300
 #define PRIORITY_QUEUES 5
 /** 
@@ -224,6 +279,34 @@ TCB* cur_thread();
 */
 TCB* spawn_thread(PCB* pcb, void (*func)());
 
+/**
+	@brief Create a new thread in a recycled thread block.
+
+	This is the same as @c spawn_thread, except that the thread block is
+	@c block, a block previously returned by @c thread_block_put, or 
+	a new block if @c block is NULL.
+*/
+TCB* spawn_thread_at(TCB* block, PCB* pcb, void (*func)());
+
+/**
+	@brief Drop a hold on a thread block.
+
+	A thread block is held by the scheduler until the thread has exited and
+	left its core, and by any other holder that added itself to @c tcb->holds
+	(e.g., the PTCB of a process thread). When the last hold is dropped by
+	the scheduler, the block is freed; when it is dropped by this call,
+	the block passes to the caller, who can reuse it via @c spawn_thread_at
+	or free it via @c free_thread_block.
+
+	@returns 1 if the last hold was dropped, else 0
+*/
+int thread_block_put(TCB* tcb);
+
+/**
+	@brief Free a thread block returned by @c thread_block_put.
+*/
+void free_thread_block(TCB* tcb);
+
 /**
   @brief Wakeup a blocked thread.
 
@@ -236,6 +319,18 @@ TCB* spawn_thread(PCB* pcb, void (*func)());
 */
 int wakeup(TCB* tcb);
 
+/**
+  @brief Wakeup a number of blocked threads.
+
+  This has the same effect as calling @c wakeup on each thread, but the
+  scheduler is locked only once.
+
+  @param tcbs the threads to be made @c READY
+  @param n the number of threads
+  @returns the number of threads whose state was @c STOPPED or @c INIT
+*/
+int wakeup_many(TCB** tcbs, unsigned int n);
+
 /** 
   @brief Block the current thread.
 
@@ -0,0 +1,156 @@
+
+#include <assert.h>
+#include "kernel_cc.h"
+#include "kernel_sched.h"
+#include "kernel_shm.h"
+
+
+/**
+	@file kernel_shm.c
+
+	@brief Shared memory segments.
+
+	Segments are kept in a hash table by name. A segment is removed from
+	the table and released when its last attachment is closed.
+  */
+
+
+/* The number of buckets in the name table; a power of 2 */
+#define SHM_BUCKETS 64
+
+/* The name table; each bucket is a list of segments */
+static rlnode shm_table[SHM_BUCKETS];
+
+
+void initialize_shm()
+{
+	for(int i=0; i<SHM_BUCKETS; i++)
+		rlnode_init(& shm_table[i], NULL);
+}
+
+
+/*
+	An attachment of a process to a segment.
+ */
+typedef struct shm_attachment {
+	shm_segment* seg;
+	rlnode node;		/* Intrusive node for PCB::shm_list */
+} shm_attachment;
+
+
+/* FNV-1a */
+static rlnode* shm_bucket(const char* name)
+{
+	unsigned int h = 2166136261u;
+	for(; *name; name++) {
+		h ^= (unsigned char) *name;
+		h *= 16777619u;
+	}
+	return & shm_table[h & (SHM_BUCKETS-1)];
+}
+
+
+static shm_segment* shm_lookup(const char* name)
+{
+	rlnode* bucket = shm_bucket(name);
+	for(rlnode* p = bucket->next; p != bucket; p = p->next) {
+		shm_segment* seg = p->obj;
+		if(strcmp(seg->name, name)==0) return seg;
+	}
+	return NULL;
+}
+
+
+static void shm_attach(PCB* pcb, shm_segment* seg)
+{
+	shm_attachment* att = xmalloc(sizeof(shm_attachment));
+	att->seg = seg;
+	rlnode_init(& att->node, att);
+	rlist_push_front(& pcb->shm_list, & att->node);
+	seg->refcount++;
+}
+
+
+static void shm_detach(shm_attachment* att)
+{
+	shm_segment* seg = att->seg;
+	rlist_remove(& att->node);
+	free(att);
+
+	assert(seg->refcount > 0);
+	if(--seg->refcount == 0) {
+		rlist_remove(& seg->hash_node);
+		free(seg->addr);
+		free(seg);
+	}
+}
+
+
+void shm_inherit(PCB* newproc, PCB* curproc)
+{
+	rlnode* list = & curproc->shm_list;
+	for(rlnode* p = list->next; p != list; p = p->next) {
+		shm_attachment* att = p->obj;
+		shm_attach(newproc, att->seg);
+	}
+}
+
+
+void shm_release_all(PCB* pcb)
+{
+	while(! is_rlist_empty(& pcb->shm_list))
+		shm_detach(pcb->shm_list.next->obj);
+}
+
+
+void* sys_ShmCreate(const char* name, size_t size)
+{
+	if(name == NULL || strnlen(name, SHM_NAME_MAX) == SHM_NAME_MAX)
+		return NULL;
+	if(size == 0 || size > SHM_MAX_SIZE)
+		return NULL;
+	if(shm_lookup(name) != NULL)
+		return NULL;
+
+	shm_segment* seg = xmalloc(sizeof(shm_segment));
+	strcpy(seg->name, name);
+	seg->addr = xmalloc(size);
+	memset(seg->addr, 0, size);
+	seg->size = size;
+	seg->refcount = 0;
+	rlnode_init(& seg->hash_node, seg);
+	rlist_push_front(shm_bucket(name), & seg->hash_node);
+
+	shm_attach(CURPROC, seg);
+	return seg->addr;
+}
+
+
+void* sys_ShmOpen(const char* name, size_t* size)
+{
+	if(name == NULL || strnlen(name, SHM_NAME_MAX) == SHM_NAME_MAX)
+		return NULL;
+
+	shm_segment* seg = shm_lookup(name);
+	if(seg == NULL)
+		return NULL;
+
+	shm_attach(CURPROC, seg);
+	if(size) *size = seg->size;
+	return seg->addr;
+}
+
+
+int sys_ShmClose(void* addr)
+{
+	rlnode* list = & CURPROC->shm_list;
+	for(rlnode* p = list->next; p != list; p = p->next) {
+		shm_attachment* att = p->obj;
+		if(att->seg->addr == addr) {
+			shm_detach(att);
+			return 0;
+		}
+	}
+	return -1;
+}
+
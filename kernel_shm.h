@@ -0,0 +1,57 @@
+#ifndef __KERNEL_SHM_H
+#define __KERNEL_SHM_H
+
+#include "util.h"
+#include "kernel_proc.h"
+
+/**
+  @file kernel_shm.h
+  @brief Shared memory segments.
+
+  Shared memory segments are named, reference-counted blocks of memory.
+  Each process keeps a list of its attachments to segments, in 
+  @c PCB::shm_list. Each attachment holds one reference to its segment.
+*/
+
+
+/**
+  @brief A shared memory segment.
+  */
+typedef struct shm_segment {
+  char name[SHM_NAME_MAX];  /**< @brief The name of the segment */
+  void* addr;               /**< @brief The memory of the segment */
+  size_t size;              /**< @brief The size of @c addr */
+  unsigned int refcount;    /**< @brief Number of attachments */
+  rlnode hash_node;         /**< @brief Intrusive node for the name table */
+} shm_segment;
+
+
+/**
+  @brief Initialize the name table of shared memory segments.
+
+  This is called at boot.
+  */
+void initialize_shm();
+
+
+/**
+  @brief Copy the attachments of a process to a new process.
+
+  This is called by @c Exec, when the new process inherits from its
+  parent.
+
+  @param newproc the new process
+  @param curproc the parent process
+  */
+void shm_inherit(PCB* newproc, PCB* curproc);
+
+
+/**
+  @brief Close all the attachments of a process.
+
+  This is called when a process exits.
+  */
+void shm_release_all(PCB* pcb);
+
+
+#endif
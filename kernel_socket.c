@@ -1,5 +1,6 @@
 
 #include "tinyos.h"
+#include "kernel_socket.h"
 
 
 Fid_t sys_Socket(port_t port)
@@ -13,18 +14,32 @@ int sys_Listen(Fid_t sock)
 }
 
 
-Fid_t sys_Accept(Fid_t lsock)
+Fid_t socket_accept(FCB* lsock)
 {
 	return NOFILE;
 }
 
 
-int sys_Connect(Fid_t sock, port_t port, timeout_t timeout)
+Fid_t sys_Accept(Fid_t lsock)
+{
+	FCB* fcb = get_fcb(lsock);
+	return fcb ? socket_accept(fcb) : NOFILE;
+}
+
+
+int socket_connect(FCB* sock, port_t port, timeout_t timeout)
 {
 	return -1;
 }
 
 
+int sys_Connect(Fid_t sock, port_t port, timeout_t timeout)
+{
+	FCB* fcb = get_fcb(sock);
+	return fcb ? socket_connect(fcb, port, timeout) : -1;
+}
+
+
 int sys_ShutDown(Fid_t sock, shutdown_mode how)
 {
 	return -1;
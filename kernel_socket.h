@@ -0,0 +1,31 @@
+#ifndef __KERNEL_SOCKET_H
+#define __KERNEL_SOCKET_H
+
+#include "kernel_streams.h"
+
+/**
+  @file kernel_socket.h
+  @brief Sockets.
+
+  These are the socket calls on an already resolved stream. They are used
+  by the system calls, and by asynchronous operations, which resolve their
+  streams when they are submitted.
+*/
+
+
+/**
+  @brief Accept a connection on a listening socket.
+
+  The new socket is installed in the file table of the current process.
+  @returns the fid of the new socket, or @c NOFILE on error
+  */
+Fid_t socket_accept(FCB* lsock);
+
+/**
+  @brief Connect a socket to a port.
+
+  @returns 0 on success, -1 on error
+  */
+int socket_connect(FCB* sock, port_t port, timeout_t timeout);
+
+#endif
@@ -7,29 +7,86 @@
 #include "kernel_proc.h"
 #include "kernel_streams.h"
 
-#define MAX_FILES MAX_PROC
+/*
+  The file table.
+
+  FCBs are not preallocated. They are carved out of slabs of FCB_SLAB_SIZE
+  objects, which are allocated on demand, until MAX_FILES FCBs exist.
+  Free FCBs are kept on per-core free lists, so that boot does O(1) work
+  and a busy core tends to reuse the FCBs it recently released.
+
+  All these structures are protected by the kernel lock.
+*/
+#define FCB_SLAB_SIZE 64
+
+typedef struct fcb_slab {
+  rlnode slab_node;           /* Intrusive node for FCB_slabs */
+  FCB fcb[FCB_SLAB_SIZE];
+} fcb_slab;
 
-FCB FT[MAX_FILES];
-rlnode FCB_freelist;
+static rlnode FCB_freelist[MAX_CORES];
+static rlnode FCB_slabs;
+static unsigned int FCB_allocated;
 
 
 void initialize_files()
 {
-  rlnode_init(&FCB_freelist,NULL);
-  for(int i=0;i<MAX_FILES;i++) {
+  for(int c=0; c<MAX_CORES; c++)
+    rlnode_init(&FCB_freelist[c], NULL);
+  rlnode_init(&FCB_slabs, NULL);
+  FCB_allocated = 0;
+}
+
 
-    FT[i].refcount = 0;
-    rlnode_init(& FT[i].freelist_node, &FT[i]);
-    rlist_push_back(&FCB_freelist, & FT[i].freelist_node);
+void finalize_files()
+{
+  while(! is_rlist_empty(&FCB_slabs))
+    free(rlist_pop_front(&FCB_slabs)->obj);
+  initialize_files();
+}
+
+
+/*
+  Allocate a new slab, if the cap allows it, and put its FCBs
+  on the given free list. Returns 0 if the cap has been reached.
+*/
+static int FCB_grow(rlnode* freelist)
+{
+  unsigned int n = MAX_FILES - FCB_allocated;
+  if(n==0) return 0;
+  if(n > FCB_SLAB_SIZE) n = FCB_SLAB_SIZE;
+
+  fcb_slab* slab = xmalloc(sizeof(fcb_slab));
+  rlnode_init(&slab->slab_node, slab);
+  rlist_push_back(&FCB_slabs, &slab->slab_node);
+  FCB_allocated += n;
+
+  for(unsigned int i=0; i<n; i++) {
+    rlnode_init(& slab->fcb[i].freelist_node, & slab->fcb[i]);
+    rlist_push_back(freelist, & slab->fcb[i].freelist_node);
   }
+  return 1;
 }
 
 
 FCB* acquire_FCB()
 {
-  if(! is_rlist_empty(& FCB_freelist)) {
-    FCB* fcb = rlist_pop_front(& FCB_freelist)->fcb;
+  rlnode* freelist = & FCB_freelist[cpu_core_id];
+
+  if(is_rlist_empty(freelist) && !FCB_grow(freelist)) {
+    /* We are at the cap, take a free FCB from some other core */
+    for(uint c=0; c<MAX_CORES; c++)
+      if(! is_rlist_empty(& FCB_freelist[c])) {
+        freelist = & FCB_freelist[c];
+        break;
+      }
+  }
+
+  if(! is_rlist_empty(freelist)) {
+    FCB* fcb = rlist_pop_front(freelist)->fcb;
     fcb->refcount = 0;
+    fcb->stats = (io_stats){ 0 };
+    fcb->devstats = NULL;
     return fcb;
   }
   else
@@ -38,7 +95,7 @@ FCB* acquire_FCB()
 
 void release_FCB(FCB* fcb)
 {
-  rlist_push_back(& FCB_freelist, & fcb->freelist_node);
+  rlist_push_front(& FCB_freelist[cpu_core_id], & fcb->freelist_node);
 }
 
 
@@ -129,6 +186,55 @@ FCB* get_fcb(Fid_t fid)
 }
 
 
+/*
+  Account a Read or Write call on the calling process, its stream, and
+  the device of the stream. The blocking waits of the call are those of
+  the calling thread since it recorded 'waits' and 'wait_ns'.
+ */
+static void FCB_account(FCB* fcb, int write, int retcode, TCB* self,
+  unsigned long waits, uint64_t wait_ns)
+{
+  io_stats* st[3] = { &self->owner_pcb->io, &fcb->stats, 
+    fcb->devstats ? &fcb->devstats->shard[cpu_core_id].s : NULL };
+
+  rusage_t* ru = & self->owner_pcb->rusage;
+  if(write) {
+    ru->writes++;
+    if(retcode > 0) ru->bytes_written += retcode;
+  } else {
+    ru->reads++;
+    if(retcode > 0) ru->bytes_read += retcode;
+  }
+
+  for(int i=0; i<3 && st[i]; i++) {
+    if(write) {
+      st[i]->writes++;
+      if(retcode > 0) st[i]->bytes_written += retcode;
+    } else {
+      st[i]->reads++;
+      if(retcode > 0) st[i]->bytes_read += retcode;
+    }
+    st[i]->waits += self->wait_count - waits;
+    st[i]->wait_ns += self->wait_ns - wait_ns;
+  }
+}
+
+
+size_t files_sysinfo(void** info)
+{
+  PCB* cur = CURPROC;
+  fid_info* rec = xmalloc(MAX_FILEID * sizeof(fid_info));
+
+  size_t n = 0;
+  for(Fid_t fid=0; fid<MAX_FILEID; fid++)
+    if(cur->FIDT[fid] != NULL)
+      rec[n++] = (fid_info){ .fid = fid, .stats = cur->FIDT[fid]->stats };
+
+  *info = rec;
+  return n * sizeof(fid_info);
+}
+
+
 int sys_Read(Fid_t fd, char *buf, unsigned int size)
 {
   int retcode = -1;
@@ -147,8 +253,13 @@ int sys_Read(Fid_t fd, char *buf, unsigned int size)
        while we are using it! */
     FCB_incref(fcb);
   
-    if(devread)
+    if(devread) {
+      TCB* self = cur_thread();
+      unsigned long waits = self->wait_count;
+      uint64_t wait_ns = self->wait_ns;
       retcode = devread(sobj, buf, size);
+      FCB_account(fcb, 0, retcode, self, waits, wait_ns);
+    }
 
     /* Need to decrease the reference to FCB */
     FCB_decref(fcb);
@@ -181,8 +292,13 @@ int sys_Write(Fid_t fd, const char *buf, unsigned int size)
     FCB_incref(fcb);
 
 
-    if(devwrite)
+    if(devwrite) {
+      TCB* self = cur_thread();
+      unsigned long waits = self->wait_count;
+      uint64_t wait_ns = self->wait_ns;
       retcode = devwrite(sobj, buf, size);
+      FCB_account(fcb, 1, retcode, self, waits, wait_ns);
+    }
 
     /* Need to decrease the reference to FCB */
     FCB_decref(fcb);
@@ -208,6 +324,15 @@ int sys_Close(int fd)
 }
 
 
+intptr_t sys_Seek(Fid_t fd, intptr_t offset, seek_whence whence)
+{
+  FCB* fcb = get_fcb(fd);
+  if(fcb == NULL || fcb->streamfunc->Seek == NULL)
+    return -1;
+  return fcb->streamfunc->Seek(fcb->streamobj, offset, whence);
+}
+
+
 /*
   Copy file descriptor oldfd into file descriptor newfd.
 
@@ -245,6 +370,12 @@ unsigned int sys_GetTerminalDevices()
 }
 
 
+unsigned int sys_GetBlockDevices()
+{
+  return device_no(DEV_BLOCK);
+}
+
+
 /**
   Open a stream for the given device.
   */
@@ -261,6 +392,7 @@ Fid_t open_stream(Device_type major, unsigned int minor)
       FCB_unreserve(1, &fid, &fcb);
       goto finerr;
   }
+  fcb->devstats = device_stats(major, minor);
   
   goto finok;
 finerr:
@@ -281,3 +413,34 @@ Fid_t sys_OpenTerminal(unsigned int termno)
   return open_stream(DEV_SERIAL, termno);
 }
 
+
+int sys_TermMode(Fid_t fid, int mode)
+{
+  FCB* fcb = get_fcb(fid);
+  if(fcb == NULL) return -1;
+  return serial_mode(fcb->streamfunc, fcb->streamobj, mode);
+}
+
+
+Fid_t sys_OpenBlockDevice(unsigned int devno)
+{
+  return open_stream(DEV_BLOCK, devno);
+}
+
+
+int sys_DeviceStats(device_class cls, unsigned int devno, io_stats* stats)
+{
+  Device_type major;
+  switch(cls) {
+    case DEVICE_NULL: major = DEV_NULL; break;
+    case DEVICE_TERMINAL: major = DEV_SERIAL; break;
+    case DEVICE_BLOCK: major = DEV_BLOCK; break;
+    default: return -1;
+  }
+
+  dev_stats* ds = device_stats(major, devno);
+  if(ds == NULL || stats == NULL) return -1;
+  device_stats_sum(ds, stats);
+  return 0;
+}
+
@@ -172,18 +172,42 @@ typedef struct file_control_block
   void* streamobj;			/**< @brief The stream object (e.g., a device) */
   file_ops* streamfunc;		/**< @brief The stream implementation methods */
   rlnode freelist_node;		/**< @brief Intrusive list node */
+
+  io_stats stats;			/**< @brief The I/O statistics of the stream */
+  dev_stats* devstats;		/**< @brief The statistics of the device, for device streams */
 } FCB;
 
 
 
+/**
+  @brief The maximum number of FCBs in the system.
+
+  FCBs are allocated lazily, so this is only a cap on the memory
+  used by the file table. It can be changed at compile time.
+ */
+#ifndef MAX_FILES
+#define MAX_FILES MAX_PROC
+#endif
+
+
 /** 
   @brief Initialization for files and streams.
 
-  This function is called at kernel startup.
+  This function is called at kernel startup. It does not
+  allocate any FCBs; these are allocated on demand.
  */
 void initialize_files();
 
 
+/**
+  @brief Release the memory held by the file table.
+
+  This function is called at kernel shutdown, after the scheduler
+  has stopped.
+ */
+void finalize_files();
+
+
 /**
 	@brief Increase the reference count of an fcb 
 
@@ -256,6 +280,17 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb);
 FCB* get_fcb(Fid_t fid);
 
 
+/**
+	@brief Return a snapshot of the I/O statistics of the current process.
+
+	An array of @c fid_info records, one per open file id, is allocated
+	and stored in @c *info.
+
+	@returns the size of the array in bytes
+ */
+size_t files_sysinfo(void** info);
+
+
 /** @} */
 
 #endif
@@ -12,13 +12,42 @@
  */
 
 
-#define PRE_CALL \
+#ifndef SYSCALL_PROFILE
+
+#define PRE_CALL(NAME) \
 kernel_lock();\
 
 
 
-#define POST_CALL \
+#define POST_CALL(NAME) \
+kernel_unlock();\
+
+
+#define PRE_CALL_NOLOCK(NAME)
+#define POST_CALL_NOLOCK(NAME)
+
+#else
+
+#define PRE_CALL(NAME) \
+uint64_t __t0 = bios_clock_ns();\
+kernel_lock();\
+uint64_t __t1 = bios_clock_ns();\
+
+
+#define POST_CALL(NAME) \
+uint64_t __t2 = bios_clock_ns();\
 kernel_unlock();\
+syscall_profile(SYS_##NAME, 1, __t1-__t0, __t2-__t1);\
+
+
+#define PRE_CALL_NOLOCK(NAME) \
+uint64_t __t1 = bios_clock_ns();\
+
+
+#define POST_CALL_NOLOCK(NAME) \
+syscall_profile(SYS_##NAME, 0, 0, bios_clock_ns()-__t1);\
+
+#endif
 
 
 /* with return */
@@ -26,9 +55,20 @@ kernel_unlock();\
 RET NAME SIG \
 {\
 	RET __ret;\
-	PRE_CALL\
+	PRE_CALL(NAME)\
+	__ret = sys_##NAME ARGS;\
+	POST_CALL(NAME)\
+	return __ret;\
+}\
+
+/* without the kernel lock */
+#define SYSCALL_NOLOCK(NAME, RET, SIG, ARGS)\
+RET NAME SIG \
+{\
+	RET __ret;\
+	PRE_CALL_NOLOCK(NAME)\
 	__ret = sys_##NAME ARGS;\
-	POST_CALL\
+	POST_CALL_NOLOCK(NAME)\
 	return __ret;\
 }\
 
@@ -36,11 +76,140 @@ RET NAME SIG \
 #define SYSCALLV(NAME, SIG, ARGS)\
 void NAME SIG \
 {\
-	PRE_CALL\
+	PRE_CALL(NAME)\
 	sys_##NAME ARGS;\
-	POST_CALL\
+	POST_CALL(NAME)\
 }\
 
 
 SYSCALLS
 
+#undef SYSCALL
+#undef SYSCALL_NOLOCK
+#undef SYSCALLV
+
+
+
+#ifdef SYSCALL_PROFILE
+
+/*
+	The syscall profile. Each core has its own histograms; since a thread
+	can be preempted and moved to another core, the counters are updated
+	atomically.
+ */
+
+typedef struct syscall_hist
+{
+	unsigned long calls;
+	uint64_t lock_ns, body_ns;
+	unsigned int lock_hist[SYSCALL_HIST_BUCKETS];
+	unsigned int body_hist[SYSCALL_HIST_BUCKETS];
+} syscall_hist;
+
+static syscall_hist syscall_prof[MAX_CORES][SYSCALL_COUNT];
+
+#define SYSCALL(NAME, RET, SIG, ARGS) [SYS_ ## NAME] = { #NAME, 1 },
+#define SYSCALL_NOLOCK(NAME, RET, SIG, ARGS) [SYS_ ## NAME] = { #NAME, 0 },
+#define SYSCALLV(NAME, SIG, ARGS) [SYS_ ## NAME] = { #NAME, 1 },
+static const struct { const char* name; int locked; } syscall_desc[SYSCALL_COUNT] = { SYSCALLS };
+#undef SYSCALL
+#undef SYSCALL_NOLOCK
+#undef SYSCALLV
+
+
+static inline unsigned int hist_bucket(uint64_t t)
+{
+	if(t < 4) return t;
+	unsigned int e = 63 - __builtin_clzll(t);
+	unsigned int b = 4*(e-1) + ((t >> (e-2)) & 3);
+	return (b < SYSCALL_HIST_BUCKETS) ? b : SYSCALL_HIST_BUCKETS-1;
+}
+
+/* The smallest latency of a bucket */
+static uint64_t hist_bucket_start(unsigned int b)
+{
+	if(b < 4) return b;
+	unsigned int e = b/4 + 1;
+	return ((uint64_t)(4 + b%4)) << (e-2);
+}
+
+
+void syscall_profile_reset()
+{
+	memset(syscall_prof, 0, sizeof(syscall_prof));
+}
+
+
+void syscall_profile(enum syscall_id id, int locked, uint64_t lock_ns, uint64_t body_ns)
+{
+	syscall_hist* h = & syscall_prof[cpu_core_id][id];
+	__atomic_fetch_add(& h->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(& h->body_ns, body_ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(& h->body_hist[hist_bucket(body_ns)], 1, __ATOMIC_RELAXED);
+	if(locked) {
+		__atomic_fetch_add(& h->lock_ns, lock_ns, __ATOMIC_RELAXED);
+		__atomic_fetch_add(& h->lock_hist[hist_bucket(lock_ns)], 1, __ATOMIC_RELAXED);
+	}
+}
+
+
+size_t syscalls_sysinfo(void** info)
+{
+	syscall_info* si = xmalloc(SYSCALL_COUNT * sizeof(syscall_info));
+	for(int id=0; id<SYSCALL_COUNT; id++) {
+		syscall_info* s = & si[id];
+		memset(s, 0, sizeof(syscall_info));
+		strncpy(s->name, syscall_desc[id].name, sizeof(s->name)-1);
+		s->locked = syscall_desc[id].locked;
+
+		for(int c=0; c<MAX_CORES; c++) {
+			syscall_hist* h = & syscall_prof[c][id];
+			s->calls += h->calls;
+			s->lock_ns += h->lock_ns;
+			s->body_ns += h->body_ns;
+			for(int b=0; b<SYSCALL_HIST_BUCKETS; b++) {
+				s->lock_hist[b] += h->lock_hist[b];
+				s->body_hist[b] += h->body_hist[b];
+			}
+		}
+	}
+	*info = si;
+	return SYSCALL_COUNT * sizeof(syscall_info);
+}
+
+
+/* The latency below which a fraction q of the calls fall */
+static uint64_t hist_quantile(unsigned int* hist, unsigned long n, double q)
+{
+	unsigned long rank = (unsigned long)(q * n), seen = 0;
+	for(unsigned int b=0; b<SYSCALL_HIST_BUCKETS; b++) {
+		seen += hist[b];
+		if(seen > rank) return hist_bucket_start(b);
+	}
+	return hist_bucket_start(SYSCALL_HIST_BUCKETS-1);
+}
+
+
+void syscall_profile_dump()
+{
+	syscall_info* si;
+	syscalls_sysinfo((void**) &si);
+
+	fprintf(stderr, "%-16s %10s %10s %10s %10s %10s %10s\n", "syscall", "calls",
+		"lock avg", "lock p99", "body avg", "body p50", "body p99");
+	for(int id=0; id<SYSCALL_COUNT; id++) {
+		syscall_info* s = & si[id];
+		if(s->calls == 0) continue;
+		fprintf(stderr, "%-16s %10lu ", s->name, s->calls);
+		if(s->locked)
+			fprintf(stderr, "%10lu %10lu ", s->lock_ns / s->calls, 
+				hist_quantile(s->lock_hist, s->calls, 0.99));
+		else
+			fprintf(stderr, "%10s %10s ", "-", "-");
+		fprintf(stderr, "%10lu %10lu %10lu\n", s->body_ns / s->calls,
+			hist_quantile(s->body_hist, s->calls, 0.5), hist_quantile(s->body_hist, s->calls, 0.99));
+	}
+	free(si);
+}
+
+#endif
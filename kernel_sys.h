@@ -4,24 +4,52 @@
 #include "bios.h"
 #include "tinyos.h"
 
+/*
+  The system calls. Each entry is one of
+  - SYSCALL(NAME, RET, SIG, ARGS), a call that returns a value,
+  - SYSCALLV(NAME, SIG, ARGS), a call without a return value,
+  - SYSCALL_NOLOCK(NAME, RET, SIG, ARGS), a call that returns a value and
+    does not take the kernel lock. Such a call may only read data that is
+    private to the calling thread, or that can be read atomically.
+ */
 #define SYSCALLS \
 SYSCALL(Exec, int, (Task task, int argl, void* args), (task, argl, args))\
+SYSCALL(ExecMany, int, (Task task, unsigned int n, int argl, void* const* args, Pid_t* pids), (task, n, argl, args, pids))\
 SYSCALLV(Exit, (int exitval), (exitval))\
-SYSCALL(GetPid, int, (void), ())\
-SYSCALL(GetPPid, int, (void), ())\
+SYSCALL_NOLOCK(GetPid, int, (void), ())\
+SYSCALL_NOLOCK(GetPPid, int, (void), ())\
+SYSCALL(GetRUsage, int, (Pid_t pid, rusage_t* usage), (pid, usage))\
 SYSCALL(WaitChild, Pid_t, (Pid_t proc, int* exitval), (proc, exitval))\
 SYSCALL(CreateThread, Tid_t, (Task task, int argl, void* args), (task, argl, args))\
-SYSCALL(ThreadSelf, Tid_t, (void), ())\
+SYSCALL_NOLOCK(ThreadSelf, Tid_t, (void), ())\
 SYSCALL(ThreadJoin, int, (Tid_t tid, int* exitval), (tid, exitval))\
 SYSCALL(ThreadDetach, int, (Tid_t tid), (tid))\
 SYSCALLV(ThreadExit, (int exitval), (exitval))\
+SYSCALL(TlsAlloc, int, (void), ())\
+SYSCALL(TlsFree, int, (int key), (key))\
+SYSCALL_NOLOCK(TlsGet, void*, (int key), (key))\
+SYSCALL_NOLOCK(TlsSet, int, (int key, void* value), (key, value))\
+SYSCALL_NOLOCK(GetVDSO, const vdso_page*, (void), ())\
+SYSCALL_NOLOCK(FutexWait, int, (int* addr, int expected, timeout_t timeout), (addr, expected, timeout))\
+SYSCALL_NOLOCK(FutexWake, int, (int* addr, unsigned int n), (addr, n))\
 SYSCALL(GetTerminalDevices, unsigned int, (), ())\
 SYSCALL(OpenTerminal, Fid_t, (unsigned int termno), (termno))\
+SYSCALL(TermMode, int, (Fid_t fid, int mode), (fid, mode))\
 SYSCALL(OpenNull, Fid_t, (), ())\
+SYSCALL(GetBlockDevices, unsigned int, (), ())\
+SYSCALL(OpenBlockDevice, Fid_t, (unsigned int devno), (devno))\
+SYSCALL(DeviceStats, int, (device_class cls, unsigned int devno, io_stats* stats), (cls, devno, stats))\
 SYSCALL(Read,int,(Fid_t fd, char *buf, unsigned int size), (fd,buf,size))\
 SYSCALL(Write,int,(Fid_t fd, const char *buf, unsigned int size), (fd,buf,size))\
 SYSCALL(Close,int,(Fid_t fd),(fd))\
 SYSCALL(Dup2,int, (Fid_t oldfd, Fid_t newfd), (oldfd,newfd))\
+SYSCALL(Seek, intptr_t, (Fid_t fd, intptr_t offset, seek_whence whence), (fd, offset, whence))\
+SYSCALL(Open, Fid_t, (const char* pathname, int flags), (pathname, flags))\
+SYSCALL(Stat, int, (const char* pathname, stat_t* st), (pathname, st))\
+SYSCALL(MkDir, int, (const char* pathname), (pathname))\
+SYSCALL(Unlink, int, (const char* pathname), (pathname))\
+SYSCALL(MMap, void*, (Fid_t fid, uintptr_t offset, size_t len), (fid, offset, len))\
+SYSCALL(MUnmap, int, (void* addr), (addr))\
 SYSCALL(Pipe, int, (pipe_t* pipe), (pipe))\
 SYSCALL(Socket, Fid_t, (port_t port), (port))\
 SYSCALL(Listen, int, (Fid_t sock), (sock))\
@@ -29,12 +57,22 @@ SYSCALL(Accept, Fid_t, (Fid_t lsock), (lsock))\
 SYSCALL(Connect, int, (Fid_t sock, port_t port, timeout_t timeout), (sock, port, timeout))\
 SYSCALL(ShutDown, int, (Fid_t sock, shutdown_mode how), (sock, how))\
 SYSCALL(OpenInfo, Fid_t, (), ())\
+SYSCALL(OpenSysInfo, Fid_t, (sysinfo_kind kind), (kind))\
+SYSCALL(AsyncSetup, Fid_t, (unsigned int entries, async_ring** ring), (entries, ring))\
+SYSCALL(AsyncEnter, int, (Fid_t ring, unsigned int to_submit, unsigned int min_complete), (ring, to_submit, min_complete))\
+SYSCALL(ShmCreate, void*, (const char* name, size_t size), (name, size))\
+SYSCALL(ShmOpen, void*, (const char* name, size_t* size), (name, size))\
+SYSCALL(ShmClose, int, (void* addr), (addr))\
+SYSCALL(SyscallBatch, int, (batch_op* ops, unsigned int n, int flags), (ops, n, flags))\
 
 
 
 #define SYSCALL(NAME, RET, SIG, ARGS)\
 RET sys_ ## NAME SIG;
 
+/* without the kernel lock */
+#define SYSCALL_NOLOCK(NAME, RET, SIG, ARGS) SYSCALL(NAME, RET, SIG, ARGS)
+
 /* without return */
 #define SYSCALLV(NAME, SIG, ARGS)\
 void sys_ ## NAME SIG;
@@ -42,6 +80,39 @@ void sys_ ## NAME SIG;
 SYSCALLS
 
 #undef SYSCALL
+#undef SYSCALL_NOLOCK
+#undef SYSCALLV
+
+
+#ifdef SYSCALL_PROFILE
+
+/*
+  Syscall profiling. When the kernel is built with SYSCALL_PROFILE, each
+  call records the time it waited for the kernel lock and the time spent
+  in its body, in per-syscall, per-core histograms.
+ */
+
+/* The ids of the system calls */
+#define SYSCALL(NAME, RET, SIG, ARGS) SYS_ ## NAME,
+#define SYSCALL_NOLOCK(NAME, RET, SIG, ARGS) SYS_ ## NAME,
+#define SYSCALLV(NAME, SIG, ARGS) SYS_ ## NAME,
+enum syscall_id { SYSCALLS SYSCALL_COUNT };
+#undef SYSCALL
+#undef SYSCALL_NOLOCK
 #undef SYSCALLV
 
+/* Record a call; @c lock_ns is ignored for calls that do not take the lock */
+void syscall_profile(enum syscall_id id, int locked, uint64_t lock_ns, uint64_t body_ns);
+
+/* Return a snapshot of the profile, as an array of syscall_info records */
+size_t syscalls_sysinfo(void** info);
+
+/* Clear the profile, at boot */
+void syscall_profile_reset();
+
+/* Print a summary of the profile to stderr, at shutdown */
+void syscall_profile_dump();
+
+#endif
+
 #endif
\ No newline at end of file
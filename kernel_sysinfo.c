@@ -0,0 +1,95 @@
+
+#include "tinyos.h"
+#include "kernel_cc.h"
+#include "kernel_streams.h"
+#include "kernel_bcache.h"
+#include "kernel_sys.h"
+#include "kernel_defer.h"
+
+
+/**
+	@file kernel_sysinfo.c
+
+	@brief System information streams.
+
+	A system information stream holds a snapshot of kernel data,
+	which is read sequentially.
+  */
+
+
+typedef struct sysinfo_snapshot
+{
+	char* data;
+	size_t size;
+	size_t pos;
+} sysinfo_snapshot;
+
+
+static int sysinfo_read(void* this, char* buf, unsigned int size)
+{
+	sysinfo_snapshot* snap = this;
+
+	size_t n = snap->size - snap->pos;
+	if(n > size) n = size;
+	memcpy(buf, snap->data + snap->pos, n);
+	snap->pos += n;
+	return n;
+}
+
+
+static int sysinfo_close(void* this)
+{
+	sysinfo_snapshot* snap = this;
+	free(snap->data);
+	free(snap);
+	return 0;
+}
+
+
+static file_ops sysinfo_fops = {
+	.Open = NULL,
+	.Read = sysinfo_read,
+	.Write = NULL,
+	.Close = sysinfo_close
+};
+
+
+Fid_t sys_OpenSysInfo(sysinfo_kind kind)
+{
+	void* data;
+	size_t size;
+
+	switch(kind) {
+		case SYSINFO_BCACHE:
+			size = bcache_sysinfo(&data); break;
+		case SYSINFO_FILES:
+			size = files_sysinfo(&data); break;
+		case SYSINFO_DEFER:
+			size = defer_sysinfo(&data); break;
+		case SYSINFO_SERIAL:
+			size = serial_sysinfo(&data); break;
+#ifdef SYSCALL_PROFILE
+		case SYSINFO_SYSCALLS:
+			size = syscalls_sysinfo(&data); break;
+#endif
+		default:
+			return NOFILE;
+	}
+
+	Fid_t fid;
+	FCB* fcb;
+	if(! FCB_reserve(1, &fid, &fcb)) {
+		free(data);
+		return NOFILE;
+	}
+
+	sysinfo_snapshot* snap = xmalloc(sizeof(sysinfo_snapshot));
+	snap->data = data;
+	snap->size = size;
+	snap->pos = 0;
+
+	fcb->streamobj = snap;
+	fcb->streamfunc = &sysinfo_fops;
+	return fid;
+}
+
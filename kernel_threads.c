@@ -3,6 +3,8 @@
 #include "kernel_proc.h"
 #include "kernel_cc.h"
 #include "kernel_streams.h"
+#include "kernel_shm.h"
+#include "kernel_mmap.h"
 
 /**
  * @brief 
@@ -25,41 +27,153 @@ void start_thread(){
 
 }
 
+/* The maximum number of thread blocks cached by a process */
+#define THREAD_CACHE_MAX 16
+
+/* The bits of a Tid that hold the slot index (plus 1) */
+#define TID_INDEX_BITS 32
+#define TID_INDEX_MASK ((((Tid_t)1) << TID_INDEX_BITS) - 1)
+
+static inline Tid_t make_tid(int idx, uint32_t gen)
+{
+  return (((Tid_t)gen) << TID_INDEX_BITS) | (Tid_t)(idx+1);
+}
+
+
+PTCB* create_ptcb(PCB* pcb, TCB* tcb, Task task, int argl, void* args)
+{
+  /* Get a free slot, doubling the table if needed */
+  if(pcb->thread_free == -1) {
+    unsigned int oldsize = pcb->thread_table_size;
+    unsigned int newsize = oldsize ? 2*oldsize : 4;
+    pcb->thread_table = realloc(pcb->thread_table, newsize*sizeof(thread_handle));
+    CHECK_CONDITION(pcb->thread_table != NULL);
+    for(unsigned int i=newsize; i>oldsize; i--) {
+      pcb->thread_table[i-1] = (thread_handle){ .ptcb=NULL, .gen=0, .next_free=pcb->thread_free };
+      pcb->thread_free = i-1;
+    }
+    pcb->thread_table_size = newsize;
+  }
+  int idx = pcb->thread_free;
+  thread_handle* slot = & pcb->thread_table[idx];
+  pcb->thread_free = slot->next_free;
+
+  /* The PTCB lives in the thread block, and holds it until released */
+  PTCB* ptcb = & tcb->ptcb_block;
+  __atomic_add_fetch(& tcb->holds, 1, __ATOMIC_RELAXED);
+  ptcb->tcb = tcb;
+  ptcb->task = task;
+  ptcb->argl = argl;
+  ptcb->args = args;
+  ptcb->exited = 0;
+  ptcb->detached = 0;
+  ptcb->exit_cv = COND_INIT;
+  /* The reference of the thread itself, dropped when it exits */
+  ptcb->refcount = 1;
+  ptcb->tid = make_tid(idx, slot->gen);
+  tcb->vdso.tid = ptcb->tid;
+
+  slot->ptcb = ptcb;
+  tcb->ptcb = ptcb;
+  pcb->thread_count++;
+
+  pcb->rusage.threads++;
+  if((unsigned int) pcb->thread_count > pcb->rusage.peak_threads)
+    pcb->rusage.peak_threads = pcb->thread_count;
+  return ptcb;
+}
+
+
+PTCB* get_ptcb(PCB* pcb, Tid_t tid)
+{
+  Tid_t idx = (tid & TID_INDEX_MASK) - 1;
+  if(tid == NOTHREAD || idx >= pcb->thread_table_size) return NULL;
+
+  thread_handle* slot = & pcb->thread_table[idx];
+  if(slot->ptcb == NULL || slot->gen != (uint32_t)(tid >> TID_INDEX_BITS)) return NULL;
+  return slot->ptcb;
+}
+
+
+TCB* spawn_process_thread(PCB* pcb, void (*func)())
+{
+  TCB* block = NULL;
+  if(! is_rlist_empty(& pcb->thread_cache)) {
+    block = rlist_pop_front(& pcb->thread_cache)->tcb;
+    pcb->thread_cache_size--;
+  }
+  return spawn_thread_at(block, pcb, func);
+}
+
+
+/* Remove a PTCB from the thread table, releasing its thread block */
+static void release_ptcb(PCB* pcb, PTCB* ptcb)
+{
+  int idx = (ptcb->tid & TID_INDEX_MASK) - 1;
+  thread_handle* slot = & pcb->thread_table[idx];
+  assert(slot->ptcb == ptcb);
+
+  slot->ptcb = NULL;
+  slot->gen++;
+  slot->next_free = pcb->thread_free;
+  pcb->thread_free = idx;
+
+  /* 
+    If the scheduler is done with the thread, the block is ours. Its
+    sched_node is free, and is used to link it in the cache.
+   */
+  TCB* tcb = ptcb->tcb;
+  if(thread_block_put(tcb)) {
+    if(pcb->thread_cache_size < THREAD_CACHE_MAX) {
+      rlnode_init(& tcb->sched_node, tcb);
+      rlist_push_front(& pcb->thread_cache, & tcb->sched_node);
+      pcb->thread_cache_size++;
+    } else
+      free_thread_block(tcb);
+  }
+}
+
+/* Drop a reference of a joiner; the last joiner of an exited thread frees it */
+static void ptcb_decref(PCB* pcb, PTCB* ptcb)
+{
+  ptcb->refcount--;
+  if(ptcb->refcount == 0 && ptcb->exited)
+    release_ptcb(pcb, ptcb);
+}
+
+/* Free the thread table of an exiting process, with any PTCBs left in it, and the thread cache */
+static void release_thread_table(PCB* pcb)
+{
+  for(unsigned int i=0; i<pcb->thread_table_size; i++) {
+    PTCB* ptcb = pcb->thread_table[i].ptcb;
+    if(ptcb && thread_block_put(ptcb->tcb))
+      free_thread_block(ptcb->tcb);
+  }
+  free(pcb->thread_table);
+  pcb->thread_table = NULL;
+  pcb->thread_table_size = 0;
+  pcb->thread_free = -1;
+
+  while(! is_rlist_empty(& pcb->thread_cache))
+    free_thread_block(rlist_pop_front(& pcb->thread_cache)->tcb);
+  pcb->thread_cache_size = 0;
+}
+
+
 /** 
   @brief Create a new thread in the current process.
   */
 Tid_t sys_CreateThread(Task task, int argl, void* args)
 {
-  //ptcb allocation using util function xmalloc
-  PTCB* ptcb = xmalloc(sizeof(PTCB));
-  TCB* currentTCB;
-
-  //owners pcb thread count increases
-  CURPROC -> thread_count++;
+  PCB* curproc = CURPROC;
 
   // spawns a thread using our new function
-  currentTCB = spawn_thread(CURPROC,start_thread);
-  
-  //initialization
-  currentTCB -> ptcb = ptcb;
-  ptcb -> tcb = currentTCB; 
-  ptcb -> argl = argl;
-  ptcb -> args = args;
-  ptcb -> task = task;
-  ptcb -> detached = 0; 
-  ptcb -> exited = 0;
-  // we define refcount to start from 1
-  ptcb -> refcount = 1;
-  ptcb -> exit_cv = COND_INIT;
-
-  rlnode_init(&ptcb -> ptcb_list_node, ptcb);
-  rlist_push_back(&CURPROC->ptcb_list, &ptcb->ptcb_list_node);
-
-  // wakes up the current thread
-  wakeup(currentTCB);
-  // returns the newly created ptcb 
-	return (Tid_t) ptcb;
-  
+  TCB* tcb = spawn_process_thread(curproc, start_thread);
+  PTCB* ptcb = create_ptcb(curproc, tcb, task, argl, args);
+
+  // wakes up the new thread
+  wakeup(tcb);
+  return ptcb->tid;
 }
 
 
@@ -69,7 +183,13 @@ Tid_t sys_CreateThread(Task task, int argl, void* args)
  */
 Tid_t sys_ThreadSelf()
 {
-	return (Tid_t) cur_thread()->ptcb;
+  return cur_thread()->vdso.tid;
+}
+
+
+const vdso_page* sys_GetVDSO()
+{
+  return & cur_thread()->vdso;
 }
 
 
@@ -102,63 +222,30 @@ Tid_t sys_ThreadSelf()
   */
 int sys_ThreadJoin(Tid_t tid, int* exitval)
 {
-  
-  // check if the given tid is 0 or the same as the current one
-  if(tid<=0 || tid==sys_ThreadSelf()){
-    return -1;
-  }
+  PCB* curproc = CURPROC;
+  PTCB* thread_to_join = get_ptcb(curproc, tid);
 
-  // find the thread with the given tid, return NULL if unsuccessful
-  PCB* curproc = CURPROC;  
-  rlnode* tmp = rlist_find(&curproc->ptcb_list, (PTCB*)tid, NULL);   // could also be a check like tid->owner_pcb!=CURPROC and probably should be, since we do not know for sure that tid is the PTCB's "key" that rlist_find uses to search
-  
-  // if the search was unsuccessful, exit
-  if(tmp == NULL){   
-    return -1;
-  }  
-  PTCB* thread_to_join = tmp->ptcb;
-
-  // check if joining the given thread is allowed
-  if(thread_to_join->detached==1){
+  // check that the thread exists, is not the caller and is joinable
+  if(thread_to_join == NULL || thread_to_join == cur_thread()->ptcb
+    || thread_to_join->detached)
     return -1;
-  }
-
-  // after the checks, we are sure the join is legal
-
-  // remove current thread's PTCB from the sched queue (TODO: change this to take into
-  // consideration the multiple queues)
-  rlist_remove(&cur_thread()->sched_node);   // the TCB is what is in the sched queue  
 
-  // increase thread_to_join's refcount
+  // hold a reference while we wait
   thread_to_join->refcount++;
 
-  // wait on the CondVar
-  while(thread_to_join->exited==0){
+  while(! thread_to_join->exited && ! thread_to_join->detached)
     kernel_wait(&thread_to_join->exit_cv, SCHED_USER);
-    
-    if(thread_to_join->detached==1){ // could the following code be in the while loop
-      return -1;
-    }
-
-  }
 
-  // save the exit value
-  if(exitval!=NULL){
-    *exitval = thread_to_join->exitval;
+  int ret = -1;
+  if(! thread_to_join->detached) {
+    if(exitval != NULL)
+      *exitval = thread_to_join->exitval;
+    ret = 0;
   }
 
-  // decrement the refcount 
-  thread_to_join->refcount--;
-
-  // destroy the ptcb once refcount reaches 0
-  if(thread_to_join->refcount==0){
-    rlist_remove(&thread_to_join->ptcb_list_node);    // remove the ptcb from the owner process's thread list
-    // do not decrease thread count as it only counts "active" threads (and if the thead_to_join's thread has already exited, we may end up with negative thread_count and undefined behavior)
-    free(thread_to_join);
-  }
-
-	return 0;
-
+  // the last joiner of an exited thread frees it
+  ptcb_decref(curproc, thread_to_join);
+  return ret;
 }
 
 /**
@@ -166,20 +253,14 @@ int sys_ThreadJoin(Tid_t tid, int* exitval)
   */
 int sys_ThreadDetach(Tid_t tid)
 {
-  PTCB* ptcb = (PTCB*) tid;
-  if (ptcb == NULL)     // check if ptcb is null
-  {
-    return -1;
-  }
-	if (rlist_find(& CURPROC->ptcb_list, ptcb, NULL)==NULL)   // check if ptcb if owned by curproc
-  {
+  PCB* curproc = CURPROC;
+  PTCB* ptcb = get_ptcb(curproc, tid);
+  if(ptcb == NULL || ptcb->exited)
     return -1;
-  }
+
   ptcb->detached = 1;
-  ptcb->refcount = 0;
   kernel_broadcast(&ptcb->exit_cv);
   return 0;
-
 }
 
 /**
@@ -194,15 +275,20 @@ void sys_ThreadExit(int exitval){
 
   curptcb->exitval = exitval;           // save the exitval
   curptcb->exited = 1;                  // set the exited flag on the PTCB
-  curptcb->refcount--;                  // decrement the refcount
   kernel_broadcast(&curptcb->exit_cv);    // wake up all the threads waiting on this one
 
+  /* Drop the reference of the thread; a joinable thread stays until joined */
+  curptcb->refcount--;
+  if(curptcb->detached && curptcb->refcount == 0)
+    release_ptcb(curproc, curptcb);
+
   if(curproc->thread_count == 0){   // if we are the last thread, do everything sys_Exit used to do in the original project
     if(get_pid(curproc)!=1){
       PCB* initpcb = get_pcb(1);
       while(!is_rlist_empty(& curproc->children_list)) {
         rlnode* child = rlist_pop_front(& curproc->children_list);
-        child->pcb->parent = initpcb;
+        /* GetPPid reads this without the kernel lock */
+        __atomic_store_n(& child->pcb->parent, initpcb, __ATOMIC_RELEASE);
         rlist_push_front(& initpcb->children_list, child);
       }
 
@@ -228,7 +314,7 @@ void sys_ThreadExit(int exitval){
 
     /* Release the args data */
     if(curproc->args) {
-      free(curproc->args);
+      release_args(curproc->args);
       curproc->args = NULL;
     }
 
@@ -239,11 +325,16 @@ void sys_ThreadExit(int exitval){
         curproc->FIDT[i] = NULL;
       }
     }
+
+    /* Detach from shared memory */
+    shm_release_all(curproc);
+
+    /* Release memory mappings */
+    mmap_release_all(curproc);
       
-    if(curptcb->refcount == 0 || curptcb->detached == 1){
-      rlist_remove(&curptcb->ptcb_list_node);  // remove the PTCB from the PCB's list
-      free(curptcb);                          // free the PTCB
-    }
+    /* No thread is left to join the others */
+    release_thread_table(curproc);
+    curproc->tls_keys = 0;
 
     /* Disconnect my main_thread */
     curproc->main_thread = NULL;
@@ -261,3 +352,56 @@ void sys_ThreadExit(int exitval){
 
 }
 
+
+/*
+  Thread-local storage.
+
+  The slots of a thread are in its TCB. TlsGet and TlsSet do not take the
+  kernel lock, since they only touch the TCB of the caller. The key bitmap 
+  is read atomically; using a key while another thread frees it is a user error.
+ */
+
+static inline int tls_key_valid(PCB* pcb, int key)
+{
+  return key >= 0 && key < MAX_TLS_KEYS 
+    && (__atomic_load_n(& pcb->tls_keys, __ATOMIC_RELAXED) & (1u << key));
+}
+
+int sys_TlsAlloc()
+{
+  PCB* curproc = CURPROC;
+  for(int key=0; key<MAX_TLS_KEYS; key++) {
+    if(curproc->tls_keys & (1u << key)) continue;
+
+    /* The slot may hold a value from a previous use of the key */
+    for(unsigned int i=0; i<curproc->thread_table_size; i++) {
+      PTCB* ptcb = curproc->thread_table[i].ptcb;
+      if(ptcb) ptcb->tcb->tls[key] = NULL;
+    }
+    __atomic_or_fetch(& curproc->tls_keys, 1u << key, __ATOMIC_RELAXED);
+    return key;
+  }
+  return NOTLSKEY;
+}
+
+int sys_TlsFree(int key)
+{
+  PCB* curproc = CURPROC;
+  if(! tls_key_valid(curproc, key)) return -1;
+  __atomic_and_fetch(& curproc->tls_keys, ~(1u << key), __ATOMIC_RELAXED);
+  return 0;
+}
+
+void* sys_TlsGet(int key)
+{
+  TCB* tcb = cur_thread();
+  return tls_key_valid(tcb->owner_pcb, key) ? tcb->tls[key] : NULL;
+}
+
+int sys_TlsSet(int key, void* value)
+{
+  TCB* tcb = cur_thread();
+  if(! tls_key_valid(tcb->owner_pcb, key)) return -1;
+  tcb->tls[key] = value;
+  return 0;
+}
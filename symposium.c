@@ -177,12 +177,14 @@ int SymposiumOfProcesses(int argl, void* args)
   SymposiumTable_init(&S, symp);
   
   /* Execute philosophers */
+  philosopher_args Args[N];
+  void* ArgsPtr[N];
   for(int i=0;i<N;i++) {
-    philosopher_args Args;
-    Args.i = i;
-    Args.S = &S;
-    Exec(PhilosopherProcess, sizeof(Args), &Args);
+    Args[i].i = i;
+    Args[i].S = &S;
+    ArgsPtr[i] = &Args[i];
   }  
+  ExecMany(PhilosopherProcess, N, sizeof(philosopher_args), ArgsPtr, NULL);
 
   /* Wait for philosophers to exit */  
   for(int i=0;i<N;i++) {
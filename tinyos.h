@@ -3,6 +3,7 @@
 #define __TINYOS_H__
 
 #include <stdint.h>
+#include <stddef.h>
 
 /**
   @file tinyos.h
@@ -55,6 +56,9 @@ typedef int Fid_t;
 
 /**
   @brief The type of a thread ID.
+
+  A thread ID is only meaningful within its process. Once a thread has
+  been joined (or has exited detached), its ID is never given to another thread.
   */
 typedef uintptr_t Tid_t;
 
@@ -241,6 +245,31 @@ typedef int (*Task)(int, void*);
 Pid_t Exec(Task task, int argl, void* args);
 
 
+/** @brief Create many processes at once.
+
+  This call has the same effect as calling `Exec(task, argl, args[i])`
+  for `i = 0, ..., n-1`, but it is cheaper: the kernel is entered once, 
+  and the new processes are made ready to run together.
+
+  Each process receives a copy of its byte array, as in @c Exec. 
+  However, when @c args[i] is the same pointer as @c args[i-1], the two
+  processes share one copy, which must then be treated as read-only.
+  If @c args is NULL, all processes get a NULL argument.
+
+  @param task the main function of the new processes
+  @param n the number of processes to create
+  @param argl the length of each byte array
+  @param args an array of @c n byte arrays, or NULL
+  @param pids an array where the @c n pids of the new processes are stored, 
+    or NULL. If fewer than @c n processes are created, the remaining pids
+    are @c NOPROC.
+  @return the number of processes created, which is less than @c n if the 
+    maximum number of processes was reached, or -1 if @c task is NULL or
+    @c argl is negative.
+  */
+int ExecMany(Task task, unsigned int n, int argl, void* const* args, Pid_t* pids);
+
+
 /** @brief Exit the current process.
 
   When this function is called by a process thread, the process terminates
@@ -291,6 +320,72 @@ Pid_t GetPid(void);
  */
 Pid_t GetPPid(void);
 
+
+/**
+  @brief The page that the kernel shares with each thread.
+
+  The kernel keeps the fields of this page up to date, so that reading
+  them needs no system call.
+
+  @see GetVDSO
+  */
+typedef struct vdso_page {
+  Pid_t pid;                    /**< @brief The pid of the process of the thread */
+  Tid_t tid;                    /**< @brief The tid of the thread */
+  uint64_t (*clock_ns)(void);   /**< @brief Return a monotonic clock, in nanoseconds */
+} vdso_page;
+
+/**
+  @brief Return the page that the kernel shares with the calling thread.
+
+  The page remains valid for as long as the thread exists. This call,
+  as well as @c GetPid, @c GetPPid and @c ThreadSelf, does not take the 
+  kernel lock.
+  */
+const vdso_page* GetVDSO(void);
+
+
+/** @brief Designates the calling process to @c GetRUsage. */
+#define RUSAGE_SELF NOPROC
+
+/** @brief Designates the waited-for descendants of the calling process to @c GetRUsage. */
+#define RUSAGE_CHILDREN ((Pid_t)-2)
+
+/**
+  @brief Resource usage of a process.
+
+  @see GetRUsage
+  */
+typedef struct rusage_t {
+  uint64_t cpu_ns;              /**< @brief CPU time of all threads, in nanoseconds */
+  unsigned long vol_switches;   /**< @brief Context switches where a thread blocked or yielded */
+  unsigned long invol_switches; /**< @brief Context switches where a thread was preempted */
+  unsigned long reads;          /**< @brief Calls to @c Read */
+  unsigned long writes;         /**< @brief Calls to @c Write */
+  uint64_t bytes_read;          /**< @brief Bytes returned by @c Read */
+  uint64_t bytes_written;       /**< @brief Bytes accepted by @c Write */
+  unsigned int pipes;           /**< @brief Pipes created */
+  unsigned int sockets;         /**< @brief Sockets created */
+  unsigned int threads;         /**< @brief Threads created, including the main thread */
+  unsigned int peak_threads;    /**< @brief The maximum number of threads alive at once */
+} rusage_t;
+
+/**
+  @brief Return the resource usage of a process.
+
+  The usage of a process covers all its threads, alive or exited. When a
+  child is waited for by @c WaitChild, its usage, together with the usage
+  of its own waited-for children, is added to the children usage of its 
+  parent. Counts are summed, and @c peak_threads is the maximum.
+
+  @param pid a process, or @c RUSAGE_SELF for the caller, or @c RUSAGE_CHILDREN
+    for the children usage of the caller.
+  @param usage the location where the usage is stored.
+  @returns 0 on success, or -1 if @c pid is not a live or zombie process, 
+    or @c usage is NULL.
+  */
+int GetRUsage(Pid_t pid, rusage_t* usage);
+
 /*******************************************
  *
  * Threads
@@ -375,6 +470,84 @@ int ThreadDetach(Tid_t tid);
 void ThreadExit(int exitval);
 
 
+/** @brief A timeout of @c FutexWait that never expires. */
+#define FUTEX_NO_TIMEOUT ((timeout_t)-1)
+
+/**
+  @brief Wait on a futex.
+
+  A futex is an @c int in memory, which is used by user-level 
+  synchronization. If the value at @c addr is equal to @c expected, 
+  the caller sleeps until @c FutexWake is called on @c addr, or until 
+  @c timeout msec expire. The comparison and the sleep are atomic with 
+  respect to @c FutexWake.
+
+  Futexes are identified by their address, so a futex in shared memory
+  can be used by different processes. This call does not take the kernel lock.
+
+  @param addr the futex
+  @param expected the value expected at @c addr
+  @param timeout the timeout in msec, or @c FUTEX_NO_TIMEOUT
+  @returns 0 if woken by @c FutexWake, or -1 if the value at @c addr was not
+    @c expected, or the timeout expired, or @c addr is NULL.
+  */
+int FutexWait(int* addr, int expected, timeout_t timeout);
+
+/**
+  @brief Wake up threads waiting on a futex.
+
+  This call does not take the kernel lock.
+
+  @param addr the futex
+  @param n the maximum number of threads to wake up
+  @returns the number of threads woken up, or -1 if @c addr is NULL.
+  */
+int FutexWake(int* addr, unsigned int n);
+
+
+/** @brief The number of thread-local storage keys of a process. */
+#define MAX_TLS_KEYS 16
+
+/** @brief The invalid thread-local storage key. */
+#define NOTLSKEY (-1)
+
+/**
+  @brief Allocate a thread-local storage key.
+
+  A key names one pointer-sized slot in every thread of the process.
+  Initially, the value of the slot is NULL in all threads.
+
+  @returns the new key, or @c NOTLSKEY if all @c MAX_TLS_KEYS keys are in use.
+  */
+int TlsAlloc();
+
+/**
+  @brief Free a thread-local storage key.
+
+  @returns 0 on success, or -1 if @c key is not allocated.
+  */
+int TlsFree(int key);
+
+/**
+  @brief Return the value of a thread-local storage slot of the current thread.
+
+  This call does not take the kernel lock.
+
+  @returns the value stored by the last @c TlsSet of this thread, 
+    or NULL if there was none, or @c key is not allocated.
+  */
+void* TlsGet(int key);
+
+/**
+  @brief Set the value of a thread-local storage slot of the current thread.
+
+  This call does not take the kernel lock.
+
+  @returns 0 on success, or -1 if @c key is not allocated.
+  */
+int TlsSet(int key, void* value);
+
+
 
 /*******************************************
  *
@@ -390,6 +563,12 @@ unsigned int GetTerminalDevices();
 
 /** @brief Open a stream on terminal device 'termno'.
 
+  Output to a terminal is queued in an output ring, which is shared by all 
+  the streams of the terminal. @c Write blocks only while the ring is full.
+  @c Close on a terminal stream blocks until the output written through 
+  that stream has been sent to the device; it does not wait for the output 
+  of other streams of the terminal.
+
   @param termno the terminal number to open
   @return the file ID of the new descriptor
     On success, OpenTerminal returns the file id for a new file for this 
@@ -400,6 +579,42 @@ unsigned int GetTerminalDevices();
 Fid_t OpenTerminal(unsigned int termno);
 
 
+/** @brief Raw terminal mode: a @c Read returns the bytes received so far. */
+#define TERM_RAW    0
+/** @brief Canonical terminal mode: a @c Read returns a whole line. */
+#define TERM_CANON  1
+/** @brief Terminal mode flag: echo the bytes received to the console. */
+#define TERM_ECHO   2
+
+/** @brief Get or set the line discipline mode of a terminal.
+
+  The mode is a combination of @c TERM_CANON and @c TERM_ECHO, or @c TERM_RAW.
+  It belongs to the terminal, so it is shared by all streams on the terminal.
+  Terminals start in raw mode.
+
+  In raw mode, a @c Read blocks until some bytes have been received, and
+  returns them.
+
+  In canonical mode, the bytes received are collected into a line, which
+  can be edited: backspace (or DEL) erases the last byte, and Ctrl-U the whole
+  line. The line ends with a newline (a carriage return is translated to a
+  newline) or with Ctrl-D. A @c Read blocks until a line has ended, and then
+  returns at most one line, including its newline; Ctrl-D is not returned,
+  so Ctrl-D at the start of a line makes a @c Read return 0.
+  Switching to raw mode makes the unfinished line readable.
+
+  With @c TERM_ECHO, the bytes received, and the effects of erasing, are
+  echoed to the console.
+
+  @param fid a stream on a terminal
+  @param mode the new mode, or -1 to leave the mode unchanged
+  @returns the previous mode, or -1 on error. Possible errors are:
+    - @c fid is not a stream on a terminal
+    - @c mode is not valid
+ */
+int TermMode(Fid_t fid, int mode);
+
+
 /** @brief Open a stream on the null device.
 
   The null device is a virtual device representing an "infinite"
@@ -414,6 +629,67 @@ Fid_t OpenTerminal(unsigned int termno);
 Fid_t OpenNull();
 
 
+/** @brief Return the number of block devices (disks) available. 
+
+  Block devices are numbered starting from 0. 
+ */
+unsigned int GetBlockDevices();
+
+/** @brief Open a stream on block device 'devno'.
+
+  The stream reads and writes whole sectors of 512 bytes, sequentially
+  from the start. Each @c Read or @c Write transfers 
+  `size / 512` sectors (fewer at the end of the device)
+  and fails with -1 if @c size is smaller than a sector. @c Read returns 0
+  at the end of the device, and @c Write fails with -1.
+
+  Transfers go through the kernel buffer cache. Written data reaches
+  the device shortly afterwards, and always before the system shuts down.
+
+  @param devno the block device to open
+  @return On success, the file id for a new file for this device. 
+   On error, it returns @c NOFILE. Possible errors are:
+   - The block device does not exist.
+   - The maximum number of file descriptors has been reached.
+ */
+Fid_t OpenBlockDevice(unsigned int devno);
+
+
+/** @brief I/O statistics of a stream or a device. 
+
+  @see DeviceStats
+  @see SYSINFO_FILES
+  @see procinfo
+ */
+typedef struct io_stats {
+  unsigned long reads;          /**< @brief The number of @c Read calls */
+  unsigned long writes;         /**< @brief The number of @c Write calls */
+  unsigned long bytes_read;     /**< @brief The number of bytes read */
+  unsigned long bytes_written;  /**< @brief The number of bytes written */
+  unsigned long waits;          /**< @brief The number of times a call blocked */
+  unsigned long wait_ns;        /**< @brief The total time calls were blocked, in nsec */
+} io_stats;
+
+/** @brief The classes of devices. */
+typedef enum {
+  DEVICE_NULL,        /**< @brief The null device (there is one) */
+  DEVICE_TERMINAL,    /**< @brief The terminals */
+  DEVICE_BLOCK        /**< @brief The block devices */
+} device_class;
+
+/** @brief Get the I/O statistics of a device.
+
+  The statistics count the @c Read and @c Write calls on all the streams
+  of the device, since the system was booted.
+
+  @param cls the class of the device
+  @param devno the number of the device in its class
+  @param stats the location to store the statistics
+  @return 0 on success, or -1 if the device does not exist.
+ */
+int DeviceStats(device_class cls, unsigned int devno, io_stats* stats);
+
+
 /** 
   @brief Read bytes from a stream. 
 
@@ -489,6 +765,176 @@ int Close(Fid_t fd);
  */
 int Dup2(Fid_t oldfd, Fid_t newfd);
 
+
+/** @brief The origin of a @c Seek.
+  */
+typedef enum {
+  SEEK_FROM_START,      /**< @brief The offset is relative to the start of the file */
+  SEEK_FROM_CURRENT,    /**< @brief The offset is relative to the current position */
+  SEEK_FROM_END         /**< @brief The offset is relative to the end of the file */
+} seek_whence;
+
+
+/** @brief Change the position of a stream.
+
+  The position of the stream becomes @c offset bytes from the origin
+  given by @c whence. The position may be placed after the end of a file;
+  a subsequent write will fill the gap with zeros.
+
+  Only some streams (e.g., files) support this operation.
+
+  @param fd the file ID of the stream
+  @param offset the new position, relative to @c whence
+  @param whence the origin of the offset
+  @return the new position of the stream, or -1 on error.
+   Possible reasons for failure:
+   - The file id is invalid.
+   - The stream does not support seeking.
+   - The new position would be negative.
+ */
+intptr_t Seek(Fid_t fd, intptr_t offset, seek_whence whence);
+
+
+/*******************************************
+ *
+ * Files
+ *
+ *******************************************/
+
+/** @brief The maximum length of a path name, including the terminating 0. */
+#define MAX_PATHNAME 512
+
+/** @brief The maximum length of a file name (a path component), including 
+  the terminating 0. */
+#define MAX_NAME_LENGTH 64
+
+/** @brief Flags for @c Open. */
+enum open_flags {
+  OPEN_READ = 1,      /**< @brief Open for reading */
+  OPEN_WRITE = 2,     /**< @brief Open for writing */
+  OPEN_RDWR = 3,      /**< @brief Open for reading and writing */
+  OPEN_CREATE = 4,    /**< @brief Create the file if it does not exist */
+  OPEN_EXCL = 8,      /**< @brief With @c OPEN_CREATE, fail if the file exists */
+  OPEN_TRUNC = 16,    /**< @brief Truncate the file to size 0 (needs @c OPEN_WRITE) */
+  OPEN_APPEND = 32    /**< @brief Every write appends to the end of the file */
+};
+
+/** @brief The type of a file system object. */
+typedef enum {
+  FILE_TYPE_REGULAR,    /**< @brief A regular file */
+  FILE_TYPE_DIR         /**< @brief A directory */
+} file_type;
+
+/** @brief File information returned by @c Stat. */
+typedef struct stat_t {
+  unsigned long ino;    /**< @brief A number that identifies the file */
+  file_type type;       /**< @brief The file type */
+  unsigned int nlink;   /**< @brief The number of directory entries for the file */
+  size_t size;          /**< @brief The size of a regular file, or the number of 
+                                    entries of a directory */
+} stat_t;
+
+
+/** @brief Open a file.
+
+  TinyOS has an in-memory file system, organized as a directory tree.
+  Path names consist of file names separated by '/'. All paths are relative
+  to the root directory; "." and ".." are supported.
+
+  The file is opened for reading, writing, or both, according to the 
+  @c OPEN_READ and @c OPEN_WRITE flags (at least one must be given).
+  The position of the new stream is 0. Directories can only be opened for 
+  reading, and they cannot be read.
+
+  The contents of the file system are lost at shutdown.
+
+  @param pathname the path name of the file
+  @param flags a combination of @c open_flags
+  @return the file ID of the new stream, or @c NOFILE on error.
+   Possible reasons for failure:
+   - The path name is too long, or a file name is too long.
+   - The file does not exist and @c OPEN_CREATE was not given,
+     or it exists and @c OPEN_CREATE|OPEN_EXCL were given.
+   - A directory of the path does not exist, or is not a directory.
+   - A directory was opened for writing.
+   - The flags are illegal.
+   - The maximum number of file descriptors has been reached.
+ */
+Fid_t Open(const char* pathname, int flags);
+
+/** @brief Get information about a file.
+
+  @param pathname the path name of the file
+  @param st the location to store the information
+  @return 0 on success, or -1 if the file does not exist.
+ */
+int Stat(const char* pathname, stat_t* st);
+
+/** @brief Create a directory.
+
+  @param pathname the path name of the new directory
+  @return 0 on success, or -1 on error. Possible reasons for failure:
+   - The path name exists.
+   - The parent directory does not exist.
+ */
+int MkDir(const char* pathname);
+
+/** @brief Remove a file or an empty directory.
+
+  The file is removed from its directory. Its contents are released 
+  once all the streams that refer to it are closed.
+
+  @param pathname the path name of the file
+  @return 0 on success, or -1 on error. Possible reasons for failure:
+   - The file does not exist.
+   - The file is a non-empty directory, or the root directory.
+ */
+int Unlink(const char* pathname);
+
+
+/** @brief The granularity of memory mappings.
+
+  A memory mapping made by @c MMap cannot cross a multiple of this size
+  in the file.
+ */
+#define MMAP_PAGE_SIZE 4096
+
+/** @brief Map part of a file into memory.
+
+  This call returns a pointer directly to the kernel's copy of
+  bytes @c offset to @c offset+len-1 of the file, so that they can be accessed 
+  without copying them by @c Read. Both files and block devices can be
+  mapped; the memory of a block device is a buffer of the buffer cache.
+
+  The range must lie inside the file and within one page, i.e., it 
+  must not cross a multiple of @c MMAP_PAGE_SIZE. To scan a large file, 
+  map it one page at a time.
+
+  The mapped memory stays valid until it is released by @c MUnmap (or the
+  process exits), even if the stream is closed or the file is unlinked.
+  It reflects later writes to the file. A file with mappings cannot be truncated.
+  The mapping should be treated as read-only: stores to it are not guaranteed
+  to reach a block device.
+
+  @param fid the file ID of the stream
+  @param offset the offset of the first byte in the file
+  @param len the number of bytes to map
+  @return a pointer to the mapped bytes, or NULL on error.
+   Possible reasons for failure:
+   - The file id is invalid.
+   - The stream does not support mapping.
+   - The range is empty, or it is not inside the file, or it crosses a page.
+ */
+void* MMap(Fid_t fid, uintptr_t offset, size_t len);
+
+/** @brief Release a memory mapping.
+
+  @param addr the address returned by @c MMap
+  @return 0 on success, or -1 if @c addr is not a mapping of the process.
+ */
+int MUnmap(void* addr);
+
+
 /*******************************************
  *
  * Pipes
@@ -695,6 +1141,259 @@ int ShutDown(Fid_t sock, shutdown_mode how);
 
 
 
+/*******************************************
+ *
+ * Asynchronous I/O
+ *
+ *******************************************/
+
+/**
+  @brief The maximum number of submission entries of an asynchronous ring.
+  */
+#define ASYNC_MAX_ENTRIES 4096
+
+/**
+  @brief Operation codes for asynchronous requests.
+
+  @see async_sqe
+  */
+typedef enum {
+  ASYNC_NOP,      /**< @brief Do nothing. Completes with result 0. */
+  ASYNC_READ,     /**< @brief Like @c Read(fid, buf, size). */
+  ASYNC_WRITE,    /**< @brief Like @c Write(fid, buf, size). */
+  ASYNC_ACCEPT,   /**< @brief Like @c Accept(fid). */
+  ASYNC_CONNECT,  /**< @brief Like @c Connect(fid, port, timeout). */
+  ASYNC_TIMEOUT   /**< @brief Complete after @c timeout msec, with result 0. */
+} async_opcode;
+
+/**
+  @brief A submission queue entry.
+
+  Each entry describes one asynchronous operation. Only the fields
+  relevant to the @c opcode are used.
+  */
+typedef struct async_sqe {
+  async_opcode opcode;    /**< @brief The operation */
+  Fid_t fid;              /**< @brief The stream of the operation. It is resolved when
+                               the entry is submitted, so it may be closed afterwards. */
+  void* buf;              /**< @brief The buffer for @c ASYNC_READ and @c ASYNC_WRITE */
+  unsigned int size;      /**< @brief The size of @c buf */
+  port_t port;            /**< @brief The port for @c ASYNC_CONNECT */
+  timeout_t timeout;      /**< @brief The timeout for @c ASYNC_CONNECT and @c ASYNC_TIMEOUT */
+  uintptr_t user_data;    /**< @brief Returned verbatim in the completion */
+} async_sqe;
+
+/**
+  @brief A completion queue entry.
+  */
+typedef struct async_cqe {
+  uintptr_t user_data;    /**< @brief The @c user_data of the submission */
+  int result;             /**< @brief The return value of the operation */
+} async_cqe;
+
+/**
+  @brief A pair of submission and completion rings shared with the kernel.
+
+  The submission queue (SQ) is produced by the process and consumed by the
+  kernel: the process fills entry `sq[sq_tail % sq_entries]` and then 
+  increments @c sq_tail. The kernel advances @c sq_head.
+
+  The completion queue (CQ) is produced by the kernel and consumed by the
+  process: entries between @c cq_head and @c cq_tail are completions, and
+  the process increments @c cq_head to consume them.
+
+  The head and tail counters increase without bound; the ring sizes are
+  powers of two.
+
+  @see AsyncSetup
+  */
+typedef struct async_ring {
+  unsigned int sq_entries;          /**< @brief Size of @c sq */
+  unsigned int cq_entries;          /**< @brief Size of @c cq */
+  volatile unsigned int sq_head;    /**< @brief Advanced by the kernel */
+  volatile unsigned int sq_tail;    /**< @brief Advanced by the process */
+  volatile unsigned int cq_head;    /**< @brief Advanced by the process */
+  volatile unsigned int cq_tail;    /**< @brief Advanced by the kernel */
+  async_sqe* sq;                    /**< @brief The submission entries */
+  async_cqe* cq;                    /**< @brief The completion entries */
+} async_ring;
+
+
+/**
+  @brief Create an asynchronous I/O ring.
+
+  The kernel allocates a submission ring of (at least) @c entries entries,
+  and a completion ring twice as large, and stores a pointer to them in
+  @c *ring. The rings are released when the returned file id is closed
+  (and all operations in flight have completed).
+
+  Like other file ids, the ring is inherited by child processes.
+
+  @param entries the requested size of the submission ring
+  @param ring a location to store the address of the rings
+  @returns a file id for the ring, or @c NOFILE on error. Possible
+    reasons for error:
+    - @c entries is 0 or larger than @c ASYNC_MAX_ENTRIES
+    - the available file ids for the process are exhausted.
+  */
+Fid_t AsyncSetup(unsigned int entries, async_ring** ring);
+
+
+/**
+  @brief Submit asynchronous operations and wait for completions.
+
+  The kernel consumes up to @c to_submit entries from the submission
+  ring and starts their execution. Then, the caller blocks until
+  at least @c min_complete completions are available in the completion
+  ring, or until no operations are in flight.
+
+  Fewer entries may be consumed, if the completion ring does not have
+  room for the completions of all operations in flight.
+
+  @param ring the file id returned by @c AsyncSetup
+  @param to_submit the maximum number of entries to submit
+  @param min_complete the number of completions to wait for
+  @returns the number of entries submitted, or -1 on error. Possible
+    reasons for error:
+    - the file id is not an asynchronous ring.
+  */
+int AsyncEnter(Fid_t ring, unsigned int to_submit, unsigned int min_complete);
+
+
+
+/*******************************************
+ *
+ * System call batches
+ *
+ *******************************************/
+
+/**
+  @brief Operation codes for batched system calls.
+
+  @see batch_op
+  */
+typedef enum {
+  BATCH_READ,     /**< @brief Like @c Read(fid, buf, size). */
+  BATCH_WRITE,    /**< @brief Like @c Write(fid, buf, size). */
+  BATCH_CLOSE,    /**< @brief Like @c Close(fid). */
+  BATCH_DUP2,     /**< @brief Like @c Dup2(fid, newfid). */
+  BATCH_PIPE,     /**< @brief Like @c Pipe(buf), where @c buf points to a @c pipe_t. */
+  BATCH_SEEK      /**< @brief Like @c Seek(fid, offset, whence). */
+} batch_opcode;
+
+/**
+  @brief A system call in a batch.
+
+  Only the fields relevant to the @c opcode are used.
+
+  @see SyscallBatch
+  */
+typedef struct batch_op {
+  batch_opcode opcode;    /**< @brief The operation */
+  Fid_t fid;              /**< @brief The stream of the operation */
+  Fid_t newfid;           /**< @brief The target fid of @c BATCH_DUP2 */
+  void* buf;              /**< @brief The buffer for @c BATCH_READ, @c BATCH_WRITE and @c BATCH_PIPE */
+  unsigned int size;      /**< @brief The size of @c buf */
+  intptr_t offset;        /**< @brief The offset for @c BATCH_SEEK */
+  seek_whence whence;     /**< @brief The origin of @c offset for @c BATCH_SEEK */
+  intptr_t result;        /**< @brief Set to the return value of the operation */
+} batch_op;
+
+/** @brief A flag of @c SyscallBatch: stop at the first operation that fails. */
+#define BATCH_STOP_ON_ERROR 1
+
+/**
+  @brief Execute a batch of system calls.
+
+  The operations are executed in order, as if each was called directly,
+  but the kernel is entered only once. The return value of each operation 
+  is stored in its @c result field. An operation fails if its return value
+  is -1 (for @c BATCH_READ and @c BATCH_WRITE, a negative value), or if 
+  its @c opcode is not legal.
+
+  Operations can use the fids created by earlier operations of the batch
+  only if the fids are known in advance (e.g., as the @c newfid of a 
+  @c BATCH_DUP2).
+
+  @param ops the operations
+  @param n the number of operations
+  @param flags 0, or @c BATCH_STOP_ON_ERROR to stop after the first 
+     operation that fails.
+  @returns the number of operations executed (including a failed one that
+     stopped the batch), or -1 if @c ops is NULL.
+  */
+int SyscallBatch(batch_op* ops, unsigned int n, int flags);
+
+
+
+/*******************************************
+ *
+ * Shared memory
+ *
+ *******************************************/
+
+/**
+  @brief The maximum length of a shared memory segment name, 
+  including the terminating 0.
+  */
+#define SHM_NAME_MAX 32
+
+/**
+  @brief The maximum size of a shared memory segment.
+  */
+#define SHM_MAX_SIZE (1<<24)
+
+
+/**
+  @brief Create a named shared memory segment.
+
+  A new segment of @c size bytes is allocated and zeroed, and it is
+  attached to the current process. Other processes can attach to the
+  same segment by name, using @c ShmOpen.
+
+  Attachments are inherited by child processes, like file ids: each process
+  created by @c Exec holds its own attachment of each segment of its parent.
+  A segment is released when its last attachment is closed, either by
+  @c ShmClose or by the exit of the process holding it. Once released, the name
+  can be reused.
+
+  @param name the name of the segment, a string of length less than @c SHM_NAME_MAX
+  @param size the size of the segment in bytes
+  @returns the address of the segment, or NULL on error. Possible
+    reasons for error:
+    - the name is too long
+    - the size is 0 or larger than @c SHM_MAX_SIZE
+    - a segment with the same name already exists.
+  */
+void* ShmCreate(const char* name, size_t size);
+
+
+/**
+  @brief Attach to an existing shared memory segment.
+
+  @param name the name of the segment
+  @param size if not NULL, the size of the segment is stored here
+  @returns the address of the segment, or NULL if there is no segment 
+    with this name.
+  */
+void* ShmOpen(const char* name, size_t* size);
+
+
+/**
+  @brief Detach from a shared memory segment.
+
+  One attachment of the current process to the segment at address @c addr
+  is closed. After this call, the process should not access the segment, unless
+  it holds other attachments to it.
+
+  @param addr the address of the segment
+  @returns 0 on success, or -1 if the process is not attached to a
+    segment at address @c addr.
+  */
+int ShmClose(void* addr);
+
+
+
 /*******************************************
  *
  * System information
@@ -726,6 +1425,9 @@ typedef struct procinfo
 	
   Task main_task;  /**< @brief The main task of the process. */
 	
+  io_stats io;     /**< @brief The I/O of the process over all its streams, 
+                        as counted for @c SYSINFO_FILES */
+
   int argl;        /**< @brief Argument length of main task. 
 
             Note that this is the
@@ -751,7 +1453,12 @@ typedef struct procinfo
 
 	There is no guarantee of the timeliness of the information.
 	A best-effort approach to return relevant system information is
-	made. 
+	made. Each record is a consistent snapshot of its process, but
+	processes created or released while the stream is read may or may not 
+	be reported.
+
+	Each @c Read returns as many whole records as fit in the buffer, 
+	and fails with -1 if the buffer is smaller than one record.
 
 	@returns a file id on success, or NOFILE on error. Possible reasons
 		for error are:
@@ -760,6 +1467,144 @@ typedef struct procinfo
 Fid_t OpenInfo();
 
 
+/**
+  @brief The kinds of system information streams.
+
+  @see OpenSysInfo
+  */
+typedef enum {
+  SYSINFO_BCACHE,   /**< @brief Buffer cache statistics, as @c bcache_info records */
+  SYSINFO_FILES,    /**< @brief I/O statistics of the streams of the calling process, 
+                         as @c fid_info records. The I/O totals of other processes
+                         are in the @c io field of their @c procinfo records. */
+  SYSINFO_SYSCALLS, /**< @brief Latency histograms of the system calls, as @c syscall_info
+                         records. Only available when the kernel is built with 
+                         @c SYSCALL_PROFILE. */
+  SYSINFO_DEFER,    /**< @brief Statistics of the deferred work of interrupt handlers,
+                         as @c defer_info records, one per core */
+  SYSINFO_SERIAL    /**< @brief The interrupt routing of the terminals, as 
+                         @c serial_route_info records */
+} sysinfo_kind;
+
+
+/**
+  @brief Buffer cache statistics for a block device.
+
+  @see OpenSysInfo
+  */
+typedef struct bcache_info
+{
+  unsigned int dev;           /**< @brief The block device */
+  unsigned long hits;         /**< @brief Reads that found the block in the cache */
+  unsigned long misses;       /**< @brief Reads that had to read the block from the device */
+  unsigned long evictions;    /**< @brief Blocks of this device replaced in the cache */
+  unsigned long writebacks;   /**< @brief Dirty blocks written back to the device */
+  unsigned long readaheads;   /**< @brief Blocks read ahead of a sequential reader */
+  unsigned int buffers;       /**< @brief Blocks currently in the cache */
+  unsigned int dirty;         /**< @brief Dirty blocks currently in the cache */
+} bcache_info;
+
+
+/**
+  @brief I/O statistics for a file id of a process.
+
+  The statistics belong to the stream, so they include the calls made
+  through all the file ids (of any process) that share the stream.
+
+  @see OpenSysInfo
+  */
+typedef struct fid_info
+{
+  Fid_t fid;                  /**< @brief The file id */
+  io_stats stats;             /**< @brief The statistics of the stream */
+} fid_info;
+
+
+/** @brief The number of buckets of a syscall latency histogram. */
+#define SYSCALL_HIST_BUCKETS 128
+
+/**
+  @brief The latency profile of a system call.
+
+  Latencies are counted in logarithmic buckets with 4 sub-buckets per
+  power of 2. A latency of @c t nanoseconds goes to bucket @c t for
+  @c t<4, and else to bucket @c 4*(e-1)+s, where @c e is the
+  index of the highest bit of @c t and @c s the value of the next two
+  bits. Latencies beyond the last bucket are counted in the last bucket.
+
+  @see OpenSysInfo
+  */
+typedef struct syscall_info
+{
+  char name[24];              /**< @brief The name of the system call */
+  unsigned long calls;        /**< @brief The number of calls */
+  int locked;                 /**< @brief Whether the call takes the kernel lock */
+  uint64_t lock_ns;           /**< @brief The total time waiting for the kernel lock */
+  uint64_t body_ns;           /**< @brief The total time executing the call, with the lock held */
+  unsigned int lock_hist[SYSCALL_HIST_BUCKETS];  /**< @brief Histogram of the lock wait */
+  unsigned int body_hist[SYSCALL_HIST_BUCKETS];  /**< @brief Histogram of the execution time */
+} syscall_info;
+
+
+/**
+  @brief Statistics of the deferred-work queue of a core.
+
+  Interrupt handlers queue the bulk of their work, to be run by a
+  kernel worker thread of the core. The latency of an item is the time
+  from its queueing to the start of its run.
+
+  @see OpenSysInfo
+  */
+typedef struct defer_info
+{
+  unsigned int core;          /**< @brief The core */
+  unsigned long queued;       /**< @brief Work items queued */
+  unsigned long coalesced;    /**< @brief Requests to queue an item that was already queued */
+  unsigned long runs;         /**< @brief Work items run by the worker */
+  unsigned long wakeups;      /**< @brief Times the worker was woken up */
+  uint64_t latency_ns;        /**< @brief The total latency of the items run */
+  uint64_t max_latency_ns;    /**< @brief The maximum latency of an item */
+  unsigned int depth;         /**< @brief Work items currently queued */
+  unsigned int max_depth;     /**< @brief The maximum number of queued items */
+} defer_info;
+
+
+/**
+  @brief The interrupt routing of a terminal.
+
+  The interrupts of each terminal are handled by one core. The kernel
+  spreads the terminals over the cores at boot, and periodically moves 
+  terminals from the core with the most terminal interrupts to the one
+  with the fewest.
+
+  @see OpenSysInfo
+  */
+typedef struct serial_route_info
+{
+  unsigned int term;          /**< @brief The terminal */
+  unsigned int core;          /**< @brief The core that handles its interrupts */
+  unsigned long rx_interrupts;  /**< @brief The input interrupts of the terminal */
+  unsigned long tx_interrupts;  /**< @brief The output interrupts of the terminal */
+  unsigned long moves;        /**< @brief The times the terminal was moved to another core */
+} serial_route_info;
+
+
+/**
+	@brief Open a system information stream.
+
+	This is a read-only stream that returns a sequence of records
+	of a type determined by @c kind. The contents of the stream
+	are a snapshot, taken when the stream is opened. 
+
+	@param kind the kind of information requested
+	@returns a file id on success, or NOFILE on error. Possible reasons
+		for error are:
+		- @c kind is not a legal value
+		- the available file ids for the process are exhausted.
+  */
+Fid_t OpenSysInfo(sysinfo_kind kind);
+
+
 
 
 /*******************************************
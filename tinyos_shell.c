@@ -21,6 +21,7 @@ int Repeat(size_t,const char**);
 int Hanoi(size_t,const char**);
 int HelpMessage(size_t,const char**);
 int SystemInfo(size_t,const char**);
+int SyscallProfile(size_t,const char**);
 int Capitalize(size_t,const char**);
 int LowerCase(size_t,const char**);
 int LineEnum(size_t,const char**);
@@ -39,6 +40,7 @@ COMMANDS[]  =
 	{"help", HelpMessage, 0, "A help message."},
 	{"ls", ListPrograms, 0, "List available programs programs."},
 	{"sysinfo", SystemInfo, 0, "Print some basic info about the current system."},
+	{"sysprof", SyscallProfile, 0, "Print the latency profile of system calls (needs a SYSCALL_PROFILE kernel)."},
 	{"runterm", RunTerm, 2, "runterm <term> <prog>  <args...> : execute '<prog> <args...>' on terminal <term>."},
 	{"sh", Shell, 0, "Run a shell."},
 	{"repeat", Repeat, 2, "repeat <n> <prog> <args...>: execute '<prog> <args...>' <n> times."},
@@ -203,6 +205,46 @@ int SystemInfo(size_t argc, const char** argv)
 }
 
 
+/* The smallest latency in the bucket where a fraction q of the calls is reached */
+static uint64_t syscall_quantile(const unsigned int* hist, unsigned long calls, double q)
+{
+	unsigned long rank = q*calls, seen = 0;
+	unsigned int b;
+	for(b=0; b<SYSCALL_HIST_BUCKETS-1; b++) {
+		seen += hist[b];
+		if(seen > rank) break;
+	}
+	return (b < 4) ? b : ((uint64_t)(4 + b%4)) << (b/4 - 1);
+}
+
+int SyscallProfile(size_t argc, const char** argv)
+{
+	Fid_t finfo = OpenSysInfo(SYSINFO_SYSCALLS);
+	if(finfo == NOFILE) {
+		printf("The kernel was not built with SYSCALL_PROFILE\n");
+		return 1;
+	}
+
+	printf("%-16s %10s %10s %10s %10s %10s\n", "Syscall", "Calls",
+		"Lock avg", "Lock p99", "Body avg", "Body p99");
+	syscall_info info;
+	while(Read(finfo, (char*) &info, sizeof(info)) == sizeof(info)) {
+		if(info.calls == 0) continue;
+		printf("%-16s %10lu ", info.name, info.calls);
+		if(info.locked)
+			printf("%10lu %10lu ", (unsigned long)(info.lock_ns / info.calls),
+				(unsigned long) syscall_quantile(info.lock_hist, info.calls, 0.99));
+		else
+			printf("%10s %10s ", "-", "-");
+		printf("%10lu %10lu\n", (unsigned long)(info.body_ns / info.calls),
+			(unsigned long) syscall_quantile(info.body_hist, info.calls, 0.99));
+	}
+	Close(finfo);
+	printf("(times in nsec)\n");
+	return 0;
+}
+
+
 int HelpMessage(size_t argc, const char** argv)
 {
 	printf("This is a simple shell for tinyos.\n\
@@ -211,6 +253,7 @@ You can run some simple commands. Every command takes a\n\
 only **integer** arguments. The list of commands and the\n\
 number of arguments for each command is shown by\n\
 typing 'ls'. \n\n\
+Prefix a pipeline with 'iostat' to see the I/O of each stage.\n\
 When you are tired of playing, type 'exit' to quit.\n\
 ");
 	return 0;
@@ -799,8 +842,67 @@ static inline Fid_t savefid(Fid_t fsaved)
 }
 
 
+/*
+	The I/O report of a pipeline stage. Stages run in the address space
+	of the shell, so they fill in the report of the shell directly.
+ */
+typedef struct stage_report {
+	Program prog;
+	io_stats in, out;		/* The streams of fids 0 and 1 */
+	uint64_t elapsed_ns;
+} stage_report;
+
+/*
+	The main task of a pipeline stage, filling in the stage report. 
+	The argument buffer holds the address of the report, followed by
+	the packed string vector of the command (as in Execute).
+ */
+static int pipeline_stage(int argl, void* args)
+{
+	/* unpack the report pointer */
+	stage_report* report;
+	memcpy(&report, args, sizeof(report));
+
+	argl -= sizeof(report);
+	args += sizeof(report);
+
+	/* unpack the string vector */
+	size_t argc = argscount(argl, args);
+	const char* argv[argc];
+	argvunpack(argc, argv, argl, args);
+
+	const vdso_page* vdso = GetVDSO();
+	uint64_t start = vdso->clock_ns();
+	int exitval = report->prog(argc, argv);
+	report->elapsed_ns = vdso->clock_ns() - start;
+
+	Fid_t finfo = OpenSysInfo(SYSINFO_FILES);
+	fid_info info;
+	while(Read(finfo, (char*) &info, sizeof(info)) == sizeof(info)) {
+		if(info.fid == 0) report->in = info.stats;
+		if(info.fid == 1) report->out = info.stats;
+	}
+	Close(finfo);
+	return exitval;
+}
+
+static void print_stage_report(const char* name, stage_report* r)
+{
+	double secs = r->elapsed_ns / 1E9;
+	printf("%-12s in %8lu B in %5lu reads, out %8lu B in %5lu writes, "
+		"blocked %5lu times for %9.3f ms, %10.1f KB/s\n",
+		name, r->in.bytes_read, r->in.reads, r->out.bytes_written, r->out.writes,
+		r->in.waits + r->out.waits, (r->in.wait_ns + r->out.wait_ns) / 1E6,
+		(secs > 0) ? r->out.bytes_written / secs / 1024 : 0.0);
+}
+
+
 int process_line(int argc, const char** argv)
 {
+	/* A pipeline prefixed by 'iostat' reports the I/O of each stage */
+	int iostat = (argc > 1 && strcmp(argv[0], "iostat")==0);
+	if(iostat) { argc--; argv++; }
+
 	/* Split up into pipeline fragments */
 	int Vargc[argc];
 	Vargc[0]=0;
@@ -838,34 +940,72 @@ int process_line(int argc, const char** argv)
 
 	/* Construct pipeline */
 	int child[frag];
+	stage_report report[frag];
 	int savein, saveout;
 
 	savein = savefid(0);
 	saveout = savefid(1);
 
+	/* 
+		The fid rewiring around each stage is done in batches. The pipe of
+		the next stage is created in the batch after the previous stage,
+		so that its fids are known when the next batch is prepared.
+	 */
 	pipe_t pipe;
+	batch_op ops[4];
+	if(frag > 1 && Pipe(& pipe)) {
+		printf("Error: could not create a pipe.\n");
+		frag = 1;
+	}
+
 	for(int i=0; i<frag; i++) {
 		if(i<frag-1) {
-			/* Not the last fragment, make a pipe */
-			Pipe(& pipe);
-			Dup2(pipe.write,1);
-			Close(pipe.write);
+			/* Not the last fragment, output to the pipe */
+			ops[0] = (batch_op){ .opcode=BATCH_DUP2, .fid=pipe.write, .newfid=1 };
+			ops[1] = (batch_op){ .opcode=BATCH_CLOSE, .fid=pipe.write };
 		} else {
 			/* Last fragment, restore saved 1 */
-			Dup2(saveout, 1);
-			Close(saveout);				
+			ops[0] = (batch_op){ .opcode=BATCH_DUP2, .fid=saveout, .newfid=1 };
+			ops[1] = (batch_op){ .opcode=BATCH_CLOSE, .fid=saveout };
 		}
+		SyscallBatch(ops, 2, BATCH_STOP_ON_ERROR);
+
+		if(iostat) {
+			/* Run the stage by pipeline_stage, passing it the report */
+			stage_report* r = &report[i];
+			*r = (stage_report){ .prog = COMMANDS[comd[i]].prog };
+
+			size_t argl = argvlen(Vargc[i], Vargv[i]) + sizeof(r);
+			char args[argl];
+			memcpy(args, &r, sizeof(r));
+			argvpack(args+sizeof(r), Vargc[i], Vargv[i]);
+			child[i] = Exec(pipeline_stage, argl, args);
+		}
+		else
+			child[i] = Execute(COMMANDS[comd[i]].prog, Vargc[i], Vargv[i]);
 
-		child[i] = Execute(COMMANDS[comd[i]].prog, Vargc[i], Vargv[i]);
-
+		int nops = 2;
 		if(i<frag-1) {
-			/* Not the last fragment, make a pipe */
-			Dup2(pipe.read,0);
-			Close(pipe.read);
+			/* Not the last fragment, input from the pipe, and make the next pipe */
+			ops[0] = (batch_op){ .opcode=BATCH_DUP2, .fid=pipe.read, .newfid=0 };
+			ops[1] = (batch_op){ .opcode=BATCH_CLOSE, .fid=pipe.read };
+			if(i+1 < frag-1)
+				ops[nops++] = (batch_op){ .opcode=BATCH_PIPE, .buf=&pipe };
 		} else {
-			/* Last fragment, restore saved 1 */
-			Dup2(savein, 0);
-			Close(savein);
+			/* Last fragment, restore saved 0 */
+			ops[0] = (batch_op){ .opcode=BATCH_DUP2, .fid=savein, .newfid=0 };
+			ops[1] = (batch_op){ .opcode=BATCH_CLOSE, .fid=savein };
+		}
+		if(SyscallBatch(ops, nops, BATCH_STOP_ON_ERROR) != nops || ops[nops-1].result != 0) {
+			/* Give up on the rest of the pipeline, and restore 0 and 1 */
+			printf("Error: could not set up the pipeline.\n");
+			ops[0] = (batch_op){ .opcode=BATCH_DUP2, .fid=savein, .newfid=0 };
+			ops[1] = (batch_op){ .opcode=BATCH_CLOSE, .fid=savein };
+			ops[2] = (batch_op){ .opcode=BATCH_DUP2, .fid=saveout, .newfid=1 };
+			ops[3] = (batch_op){ .opcode=BATCH_CLOSE, .fid=saveout };
+			SyscallBatch(ops, 4, 0);
+			frag = i+1;
+			break;
 		}
 	}
 
@@ -877,6 +1017,10 @@ int process_line(int argc, const char** argv)
 			printf("%s exited with status %d\n", Vargv[i][0], exitval);						
 	}
 
+	if(iostat)
+		for(int i=0; i<frag; i++)
+			print_stage_report(Vargv[i][0], &report[i]);
+
 	return 1;
 }
 
@@ -892,6 +1036,18 @@ int Shell(size_t argc, const char** argv)
 	fin = fidopen(0, "r");
 	fout = fidopen(1, "w");		
 
+	/* 
+		On a terminal, read whole lines in canonical mode. Then, the input 
+		can be buffered, since a Read never returns more than one line.
+	 */
+	int termmode = TermMode(0, -1);
+	char* inbuf = NULL;
+	if(termmode != -1) {
+		TermMode(0, TERM_CANON);
+		inbuf = malloc(1024);
+		setvbuf(fin, inbuf, _IOLBF, 1024);
+	}
+
 	fprintf(fout,"Starting tinyos shell\nType 'help' for help, 'exit' to quit.\n");
 
 	const int ARGN = 128;
@@ -940,9 +1096,11 @@ int Shell(size_t argc, const char** argv)
 	}
 	fprintf(fout,"Exiting\n");
 finished:
+	if(termmode != -1) TermMode(0, termmode);
 	free(cmdline);
 	fclose(fin);
 	fclose(fout);
+	free(inbuf);
 	return exitval;
 }
 
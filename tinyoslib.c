@@ -172,22 +172,98 @@ int Execute(Program prog, size_t argc, const char** argv)
 void BarrierSync(barrier* bar, unsigned int n)
 {
 	assert(n>0);
-	Mutex_Lock(& bar->mx);
 
-	int epoch = bar->epoch;
-	assert(bar->count < n);
-
-	bar->count ++;
-	if(bar->count == n) {
-		bar->epoch ++;
-		bar->count = 0;
-		Cond_Broadcast(&bar->cv);
+	/* The epoch must be read before we are counted */
+	int epoch = __atomic_load_n(& bar->epoch, __ATOMIC_ACQUIRE);
+	unsigned int count = __atomic_add_fetch(& bar->count, 1, __ATOMIC_ACQ_REL);
+	assert(count <= n);
+
+	if(count == n) {
+		/* The last thread to arrive starts the next epoch */
+		__atomic_store_n(& bar->count, 0, __ATOMIC_RELAXED);
+		__atomic_add_fetch(& bar->epoch, 1, __ATOMIC_RELEASE);
+		FutexWake(& bar->epoch, n-1);
+		return;
 	}
 
-	while(epoch == bar->epoch)
-		Cond_Wait(&bar->mx, &bar->cv);
+	while(__atomic_load_n(& bar->epoch, __ATOMIC_ACQUIRE) == epoch)
+		FutexWait(& bar->epoch, epoch, FUTEX_NO_TIMEOUT);
+}
+
+
+
+
+async_sqe* AsyncGetSqe(async_ring* ring)
+{
+	unsigned int head = __atomic_load_n(& ring->sq_head, __ATOMIC_ACQUIRE);
+	if(ring->sq_tail - head >= ring->sq_entries)
+		return NULL;
+	return & ring->sq[ring->sq_tail & (ring->sq_entries-1)];
+}
+
 
-	Mutex_Unlock(& bar->mx);
+void AsyncQueue(async_ring* ring)
+{
+	__atomic_store_n(& ring->sq_tail, ring->sq_tail+1, __ATOMIC_RELEASE);
+}
+
+
+int AsyncReap(async_ring* ring, async_cqe* cqe)
+{
+	unsigned int head = ring->cq_head;
+	if(head == __atomic_load_n(& ring->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	*cqe = ring->cq[head & (ring->cq_entries-1)];
+	__atomic_store_n(& ring->cq_head, head+1, __ATOMIC_RELEASE);
+	return 1;
 }
 
 
+shm_ring* ShmRingInit(void* mem, size_t size)
+{
+	if(size < sizeof(shm_ring)+1) return NULL;
+
+	size_t cap = 1;
+	while(2*cap <= size - sizeof(shm_ring)) cap <<= 1;
+
+	shm_ring* ring = mem;
+	ring->size = cap;
+	ring->head = ring->tail = 0;
+	return ring;
+}
+
+
+size_t ShmRingWrite(shm_ring* ring, const void* buf, size_t size)
+{
+	size_t tail = ring->tail;
+	size_t head = __atomic_load_n(& ring->head, __ATOMIC_ACQUIRE);
+	size_t room = ring->size - (tail - head);
+	if(size > room) size = room;
+
+	/* Copy in at most two pieces */
+	size_t pos = tail & (ring->size-1);
+	size_t n1 = (size < ring->size - pos) ? size : ring->size - pos;
+	memcpy(ring->data + pos, buf, n1);
+	memcpy(ring->data, (const char*)buf + n1, size - n1);
+
+	__atomic_store_n(& ring->tail, tail+size, __ATOMIC_RELEASE);
+	return size;
+}
+
+
+size_t ShmRingRead(shm_ring* ring, void* buf, size_t size)
+{
+	size_t head = ring->head;
+	size_t tail = __atomic_load_n(& ring->tail, __ATOMIC_ACQUIRE);
+	size_t avail = tail - head;
+	if(size > avail) size = avail;
+
+	size_t pos = head & (ring->size-1);
+	size_t n1 = (size < ring->size - pos) ? size : ring->size - pos;
+	memcpy(buf, ring->data + pos, n1);
+	memcpy((char*)buf + n1, ring->data, size - n1);
+
+	__atomic_store_n(& ring->head, head+size, __ATOMIC_RELEASE);
+	return size;
+}
+
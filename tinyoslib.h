@@ -74,16 +74,96 @@ int ParseProcInfo(procinfo* pinfo, Program* prog, int argc, const char** argv );
 
 
 
+/**
+	@brief A barrier for threads, based on a futex.
+
+	Threads that call @c BarrierSync only enter the kernel in order to
+	wait and be woken up.
+  */
 typedef struct barrier {
-	Mutex mx;
-	CondVar cv;
-	unsigned int count, epoch;
+	unsigned int count;
+	int epoch;
 } barrier;
 
-#define BARRIER_INIT  ((barrier){ MUTEX_INIT, COND_INIT, 0, 0})
+#define BARRIER_INIT  ((barrier){ 0, 0 })
 
 
 void BarrierSync(barrier* bar, unsigned int n);
 
 
+/**
+	@brief Get a free submission entry of an async ring.
+
+	The entry is not visible to the kernel until @ref AsyncQueue is called.
+
+	@param ring the ring returned by @c AsyncSetup
+	@returns a pointer to the next submission entry, or NULL if the 
+	   submission ring is full.
+	@see AsyncSetup
+  */
+async_sqe* AsyncGetSqe(async_ring* ring);
+
+/**
+	@brief Publish the last entry returned by @ref AsyncGetSqe.
+  */
+void AsyncQueue(async_ring* ring);
+
+/**
+	@brief Remove a completion entry from an async ring.
+
+	@param ring the ring returned by @c AsyncSetup
+	@param cqe the location to copy the completion entry to
+	@returns 1 if a completion was copied, 0 if the completion ring is empty.
+  */
+int AsyncReap(async_ring* ring, async_cqe* cqe);
+
+
+/**
+	@brief A single-producer, single-consumer byte ring in shared memory.
+
+	A ring is placed at the start of a shared memory segment by
+	@ref ShmRingInit. Afterwards, one process may write to it and
+	another process may read from it, without any system calls,
+	by casting the address of the segment to @c shm_ring*.
+
+	The @c head and @c tail counters increase without bound, and are kept
+	on different cache lines, so that the producer and the consumer do not 
+	contend.
+  */
+typedef struct shm_ring {
+	size_t size;							/**< @brief The size of @c data, a power of 2 */
+	_Alignas(64) volatile size_t head;		/**< @brief Advanced by the consumer */
+	_Alignas(64) volatile size_t tail;		/**< @brief Advanced by the producer */
+	_Alignas(64) char data[];				/**< @brief The ring buffer */
+} shm_ring;
+
+/**
+	@brief Initialize a ring in a memory block.
+
+	The ring occupies the memory at @c mem, and its capacity is the 
+	largest power of 2 that fits in @c size bytes, after the ring header.
+
+	@param mem the address of a shared memory segment
+	@param size the size of the segment
+	@returns the ring, or NULL if @c size is too small.
+  */
+shm_ring* ShmRingInit(void* mem, size_t size);
+
+/**
+	@brief Write to a ring, without blocking.
+
+	@returns the number of bytes written, which may be less than @c size
+		(possibly 0) if the ring is full.
+  */
+size_t ShmRingWrite(shm_ring* ring, const void* buf, size_t size);
+
+/**
+	@brief Read from a ring, without blocking.
+
+	@returns the number of bytes read, which may be less than @c size 
+		(possibly 0) if the ring is empty.
+  */
+size_t ShmRingRead(shm_ring* ring, void* buf, size_t size);
+
+
 #endif
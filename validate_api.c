@@ -2575,11 +2575,1482 @@ BARE_TEST(dummy_user_test,
 }
 
 
+BOOT_TEST(test_async_ring,
+	"Test that operations submitted to an async ring complete, even when they block."
+	)
+{
+	async_ring* ring;
+	ASSERT(AsyncSetup(0, &ring)==NOFILE);
+	Fid_t afid = AsyncSetup(3, &ring);
+	ASSERT(afid!=NOFILE);
+	ASSERT(ring->sq_entries==4 && ring->cq_entries==8);
+
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	char rbuf[16];
+	const char* msg = "Hello async";
+	async_sqe* sqe;
+
+	/* The read will block in the kernel, until the write is executed */
+	ASSERT((sqe = AsyncGetSqe(ring)) != NULL);
+	*sqe = (async_sqe){ .opcode=ASYNC_READ, .fid=pipe.read, .buf=rbuf, .size=sizeof(rbuf), .user_data=1 };
+	AsyncQueue(ring);
+	ASSERT((sqe = AsyncGetSqe(ring)) != NULL);
+	*sqe = (async_sqe){ .opcode=ASYNC_NOP, .user_data=2 };
+	AsyncQueue(ring);
+	ASSERT(AsyncEnter(afid, 2, 1)==2);
+
+	ASSERT((sqe = AsyncGetSqe(ring)) != NULL);
+	*sqe = (async_sqe){ .opcode=ASYNC_WRITE, .fid=pipe.write, .buf=(char*)msg, .size=strlen(msg)+1, .user_data=3 };
+	AsyncQueue(ring);
+	ASSERT((sqe = AsyncGetSqe(ring)) != NULL);
+	*sqe = (async_sqe){ .opcode=ASYNC_TIMEOUT, .timeout=10, .user_data=4 };
+	AsyncQueue(ring);
+	ASSERT((sqe = AsyncGetSqe(ring)) != NULL);
+	*sqe = (async_sqe){ .opcode=ASYNC_READ, .fid=MAX_FILEID, .user_data=5 };
+	AsyncQueue(ring);
+	ASSERT(AsyncEnter(afid, 3, 5)==3);
+
+	int result[6] = { -2, -2, -2, -2, -2, -2 };
+	async_cqe cqe;
+	for(int i=0; i<5; i++) {
+		ASSERT(AsyncReap(ring, &cqe));
+		ASSERT(cqe.user_data>=1 && cqe.user_data<=5);
+		result[cqe.user_data] = cqe.result;
+	}
+	ASSERT(! AsyncReap(ring, &cqe));
+
+	ASSERT(result[1]==strlen(msg)+1);
+	ASSERT(strcmp(rbuf, msg)==0);
+	ASSERT(result[2]==0);
+	ASSERT(result[3]==strlen(msg)+1);
+	ASSERT(result[4]==0);
+	ASSERT(result[5]==-1);
+
+	/* A ring is not a stream */
+	ASSERT(Read(afid, rbuf, 1)==-1);
+	ASSERT(AsyncEnter(pipe.read, 0, 0)==-1);
+	ASSERT(Close(afid)==0);
+	ASSERT(AsyncEnter(afid, 0, 0)==-1);
+	return 0;
+}
+
+
+struct async_child_args {
+	Fid_t afid;
+	async_ring* ring;
+};
+
+static int async_exiting_child(int argl, void* args)
+{
+	struct async_child_args* a = args;
+	async_ring* ring = a->ring;
+	async_sqe* sqe;
+
+	/* Submit and exit, without waiting for the completions */
+	ASSERT((sqe = AsyncGetSqe(ring)) != NULL);
+	*sqe = (async_sqe){ .opcode=ASYNC_TIMEOUT, .timeout=100, .user_data=1 };
+	AsyncQueue(ring);
+	ASSERT((sqe = AsyncGetSqe(ring)) != NULL);
+	*sqe = (async_sqe){ .opcode=ASYNC_ACCEPT, .fid=MAX_FILEID, .user_data=2 };
+	AsyncQueue(ring);
+	ASSERT(AsyncEnter(a->afid, 2, 0)==2);
+
+	/* Let the timeout start executing */
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	Cond_TimedWait(&mx, &cv, 20);
+	Mutex_Unlock(&mx);
+	return 0;
+}
+
+static int async_nop_child(int argl, void* args)
+{
+	return 0;
+}
+
+BOOT_TEST(test_async_submitter_exit,
+	"Test that the process of a submitter that exits is not reused while its "
+	"asynchronous operations are pending."
+	)
+{
+	async_ring* ring;
+	Fid_t afid = AsyncSetup(4, &ring);
+	ASSERT(afid!=NOFILE);
+
+	/* The child inherits the ring */
+	struct async_child_args a = { afid, ring };
+	Pid_t pid = Exec(async_exiting_child, sizeof(a), &a);
+	ASSERT(pid != NOPROC);
+	ASSERT(WaitChild(pid, NULL)==pid);
+
+	Pid_t pid2 = Exec(async_nop_child, 0, NULL);
+	ASSERT(pid2 != NOPROC && pid2 != pid);
+	ASSERT(WaitChild(pid2, NULL)==pid2);
+
+	ASSERT(AsyncEnter(afid, 0, 2)==0);
+	int result[3] = { -2, -2, -2 };
+	async_cqe cqe;
+	for(int i=0; i<2; i++) {
+		ASSERT(AsyncReap(ring, &cqe));
+		ASSERT(cqe.user_data>=1 && cqe.user_data<=2);
+		result[cqe.user_data] = cqe.result;
+	}
+	/* The stream of ACCEPT is resolved at submission */
+	ASSERT(result[2]==-1);
+
+	/* Now the process can be reused */
+	Pid_t pid3 = Exec(async_nop_child, 0, NULL);
+	ASSERT(pid3 == pid);
+	ASSERT(WaitChild(pid3, NULL)==pid3);
+	ASSERT(Close(afid)==0);
+	return 0;
+}
+
+
+static int shm_ring_producer(int argl, void* args)
+{
+	int N = *(int*)args;
+	size_t size;
+	shm_ring* ring = ShmOpen("test_shm_ring", &size);
+	ASSERT(ring != NULL && size == 1024);
+
+	for(int i=0; i<N; i++) {
+		while(ShmRingWrite(ring, &i, sizeof(i)) == 0);
+	}
+
+	ASSERT(ShmClose(ring)==0);
+	/* We still hold the attachment inherited from the parent */
+	ASSERT(ShmClose(ring)==0);
+	ASSERT(ShmClose(ring)==-1);
+	return 0;
+}
+
+BOOT_TEST(test_shm_ring,
+	"Test that shared memory segments are reference counted, and that a producer and a consumer "
+	"process can exchange data through a ring in a segment."
+	)
+{
+	ASSERT(ShmCreate("test_shm_ring", 0)==NULL);
+	ASSERT(ShmCreate("a name which is longer than SHM_NAME_MAX", 1024)==NULL);
+	ASSERT(ShmOpen("test_shm_ring", NULL)==NULL);
+
+	void* seg = ShmCreate("test_shm_ring", 1024);
+	ASSERT(seg != NULL);
+	ASSERT(ShmCreate("test_shm_ring", 1024)==NULL);
+	for(int i=0;i<1024;i++) ASSERT(((char*)seg)[i]==0);
+
+	shm_ring* ring = ShmRingInit(seg, 1024);
+	ASSERT(ring != NULL && ring->size == 512);
+
+	int N = 10000;
+	Pid_t pid = Exec(shm_ring_producer, sizeof(N), &N);
+	ASSERT(pid != NOPROC);
+
+	for(int i=0; i<N; i++) {
+		int x;
+		while(ShmRingRead(ring, &x, sizeof(x)) == 0);
+		ASSERT(x == i);
+	}
+	ASSERT(WaitChild(pid, NULL)==pid);
+
+	/* The last attachment releases the segment */
+	ASSERT(ShmOpen("test_shm_ring", NULL)==seg);
+	ASSERT(ShmClose(seg)==0);
+	ASSERT(ShmClose(seg)==0);
+	ASSERT(ShmClose(seg)==-1);
+	ASSERT(ShmOpen("test_shm_ring", NULL)==NULL);
+
+	/* Attachments are released at exit */
+	ASSERT(ShmCreate("test_shm_ring", 1024) != NULL);
+	return 0;
+}
+
+
+static int blkdev_writer(int argl, void* args)
+{
+	Fid_t fid = *(Fid_t*)args;
+	char sector[512];
+	for(int j=0; j<8; j++) {
+		memset(sector, j, sizeof(sector));
+		memcpy(sector, &j, sizeof(j));
+		ASSERT(Write(fid, sector, sizeof(sector))==sizeof(sector));
+	}
+	return 0;
+}
+
+BOOT_TEST(test_block_device,
+	"Test that concurrent writes to a block device can be read back. "
+	"This needs a disk, which is created by 'make disks'."
+	)
+{
+	ASSERT(GetBlockDevices() >= 1);
+	ASSERT(OpenBlockDevice(GetBlockDevices())==NOFILE);
+
+	Fid_t fid = OpenBlockDevice(0);
+	ASSERT(fid != NOFILE);
+	char small[100];
+	ASSERT(Read(fid, small, sizeof(small))==-1);
+	ASSERT(Write(fid, small, sizeof(small))==-1);
+
+	/* 8 threads write a sector at a time, sharing the stream position */
+	Tid_t tids[8];
+	for(int i=0; i<8; i++)
+		ASSERT((tids[i] = CreateThread(blkdev_writer, sizeof(fid), &fid)) != NOTHREAD);
+	for(int i=0; i<8; i++)
+		ASSERT(ThreadJoin(tids[i], NULL)==0);
+	Close(fid);
+
+	/* Read the 64 sectors back, with one request */
+	static char data[64*512];
+	fid = OpenBlockDevice(0);
+	ASSERT(Read(fid, data, sizeof(data))==sizeof(data));
+	Close(fid);
+
+	int seen[8] = { 0 };
+	for(int i=0; i<64; i++) {
+		char* sector = data + 512*i;
+		int j;
+		memcpy(&j, sector, sizeof(j));
+		ASSERT(j>=0 && j<8);
+		seen[j]++;
+		for(int k=sizeof(j); k<512; k++)
+			ASSERT(sector[k]==j);
+	}
+	for(int j=0; j<8; j++)
+		ASSERT(seen[j]==8);
+	return 0;
+}
+
+
+static bcache_info get_bcache_info(unsigned int dev)
+{
+	bcache_info info;
+	Fid_t fid = OpenSysInfo(SYSINFO_BCACHE);
+	ASSERT(fid != NOFILE);
+	do {
+		ASSERT(Read(fid, (char*)&info, sizeof(info))==sizeof(info));
+	} while(info.dev != dev);
+	Close(fid);
+	return info;
+}
+
+static volatile int slow_reader_done;
+
+/* A sequential reader, which keeps the daemon busy with read-ahead */
+static int slow_reader(int argl, void* args)
+{
+	Fid_t fid = OpenBlockDevice(0);
+	ASSERT(fid != NOFILE);
+	static char block[4096];
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	/* Skip the cached blocks, which are not read ahead */
+	for(int i=0; ! slow_reader_done && Read(fid, block, sizeof(block))==sizeof(block); i++)
+		if(i >= 40) Cond_TimedWait(&mx, &cv, 10);
+	Mutex_Unlock(&mx);
+	Close(fid);
+	return 0;
+}
+
+BOOT_TEST(test_buffer_cache,
+	"Test that the buffer cache reads ahead for sequential readers, and writes back "
+	"dirty blocks in the background, even while it reads ahead."
+	)
+{
+	ASSERT(OpenSysInfo(-1)==NOFILE);
+	ASSERT(GetBlockDevices() >= 1);
+
+	Fid_t fid = OpenBlockDevice(0);
+	ASSERT(fid != NOFILE);
+	static char block[4096];
+	for(int i=0; i<32; i++)
+		ASSERT(Read(fid, block, sizeof(block))==sizeof(block));
+
+	bcache_info info = get_bcache_info(0);
+	ASSERT(info.readaheads > 0);
+	ASSERT(info.hits > 0);
+	ASSERT(info.hits + info.misses == 32);
+	ASSERT(info.buffers >= 32);
+
+	/* Dirty a block, and wait for it to be written back */
+	ASSERT(Write(fid, block, 512)==512);
+	Close(fid);
+	info = get_bcache_info(0);
+	ASSERT(info.dirty == 1);
+
+	slow_reader_done = 0;
+	Tid_t reader = CreateThread(slow_reader, 0, NULL);
+
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	for(int i=0; i<20 && info.dirty > 0; i++) {
+		Cond_TimedWait(&mx, &cv, 50);
+		info = get_bcache_info(0);
+	}
+	Mutex_Unlock(&mx);
+	slow_reader_done = 1;
+	ASSERT(ThreadJoin(reader, NULL)==0);
+	ASSERT(info.dirty == 0);
+	ASSERT(info.writebacks == 1);
+	return 0;
+}
+
+
+static int ramfs_reader(int argl, void* args)
+{
+	Fid_t fid = Open("/data/big", OPEN_READ);
+	if(fid == NOFILE) return -1;
+	static char buf[3][10000];
+	char* b = buf[argl];
+	int total = 0, n;
+	while((n = Read(fid, b, 10000)) > 0) {
+		for(int i=0; i<n; i++)
+			if(b[i] != (char)((total+i) % 251)) return -1;
+		total += n;
+	}
+	Close(fid);
+	return total;
+}
+
+BOOT_TEST(test_ramfs,
+	"Test the in-memory file system: creating, writing, reading, seeking, appending, "
+	"directories, unlinking, and concurrent readers."
+	)
+{
+	stat_t st;
+	ASSERT(Stat("/", &st)==0);
+	ASSERT(st.type == FILE_TYPE_DIR);
+	ASSERT(Open("/nothere", OPEN_READ)==NOFILE);
+	ASSERT(Open("/x", OPEN_CREATE)==NOFILE);
+
+	/* Create and write a file */
+	Fid_t fid = Open("/hello", OPEN_RDWR|OPEN_CREATE|OPEN_EXCL);
+	ASSERT(fid != NOFILE);
+	ASSERT(Open("/hello", OPEN_RDWR|OPEN_CREATE|OPEN_EXCL)==NOFILE);
+	ASSERT(Write(fid, "hello world", 11)==11);
+	ASSERT(Stat("/hello", &st)==0);
+	ASSERT(st.type == FILE_TYPE_REGULAR && st.size == 11 && st.nlink == 1);
+
+	/* Seek and read */
+	char buf[32];
+	ASSERT(Seek(fid, 6, SEEK_FROM_START)==6);
+	ASSERT(Read(fid, buf, sizeof(buf))==5);
+	ASSERT(memcmp(buf, "world", 5)==0);
+	ASSERT(Read(fid, buf, sizeof(buf))==0);
+	ASSERT(Seek(fid, -5, SEEK_FROM_END)==6);
+	ASSERT(Seek(fid, -1, SEEK_FROM_START)==-1);
+	Close(fid);
+
+	/* Append and truncate */
+	fid = Open("/hello", OPEN_WRITE|OPEN_APPEND);
+	ASSERT(Write(fid, "!", 1)==1);
+	Close(fid);
+	ASSERT(Stat("/hello", &st)==0 && st.size == 12);
+	fid = Open("/hello", OPEN_WRITE|OPEN_TRUNC);
+	ASSERT(fid != NOFILE);
+	ASSERT(Stat("/hello", &st)==0 && st.size == 0);
+	ASSERT(Read(fid, buf, 1)==-1);
+	Close(fid);
+
+	/* Directories */
+	ASSERT(MkDir("/data")==0);
+	ASSERT(MkDir("/data")==-1);
+	ASSERT(MkDir("/hello/x")==-1);
+	ASSERT(Open("/data", OPEN_WRITE)==NOFILE);
+	ASSERT(Stat("/data/../data/.", &st)==0 && st.type == FILE_TYPE_DIR);
+
+	/* A large file, crossing many pages, read by concurrent readers */
+	fid = Open("/data/big", OPEN_WRITE|OPEN_CREATE);
+	ASSERT(fid != NOFILE);
+	static char data[100000];
+	for(int i=0; i<100000; i++) data[i] = i % 251;
+	for(int i=0; i<100000; i+=1000)
+		ASSERT(Write(fid, data+i, 1000)==1000);
+	Close(fid);
+	ASSERT(Stat("/data/big", &st)==0 && st.size == 100000);
+
+	Tid_t t[3];
+	for(int i=0; i<3; i++)
+		t[i] = CreateThread(ramfs_reader, i, NULL);
+	for(int i=0; i<3; i++) {
+		int exitval;
+		ASSERT(ThreadJoin(t[i], &exitval)==0);
+		ASSERT(exitval == 100000);
+	}
+
+	/* Unlink */
+	ASSERT(Unlink("/data")==-1);
+	fid = Open("/data/big", OPEN_READ);
+	ASSERT(Unlink("/data/big")==0);
+	ASSERT(Stat("/data/big", &st)==-1);
+	ASSERT(Read(fid, buf, 10)==10);		/* still readable while open */
+	Close(fid);
+	ASSERT(Unlink("/data")==0);
+	ASSERT(Unlink("/")==-1);
+	ASSERT(Unlink("/hello")==0);
+	ASSERT(Stat("/", &st)==0 && st.size == 0);
+	return 0;
+}
+
+
+BOOT_TEST(test_mmap,
+	"Test that files and block devices can be mapped into memory, and that the "
+	"mappings outlive their streams."
+	)
+{
+	Fid_t fid = Open("/mapped", OPEN_RDWR|OPEN_CREATE);
+	ASSERT(fid != NOFILE);
+	static char data[3*MMAP_PAGE_SIZE];
+	for(int i=0; i<sizeof(data); i++) data[i] = i % 253;
+	ASSERT(Write(fid, data, sizeof(data))==sizeof(data));
+
+	/* Bad ranges */
+	ASSERT(MMap(fid, 0, 0)==NULL);
+	ASSERT(MMap(fid, 100, MMAP_PAGE_SIZE)==NULL);
+	ASSERT(MMap(fid, sizeof(data)-10, 20)==NULL);
+	ASSERT(MMap(NOFILE, 0, 10)==NULL);
+	ASSERT(MUnmap(data)==-1);
+
+	/* Scan the file one page at a time */
+	char* page[3];
+	for(int p=0; p<3; p++) {
+		page[p] = MMap(fid, p*MMAP_PAGE_SIZE, MMAP_PAGE_SIZE);
+		ASSERT(page[p] != NULL);
+		ASSERT(memcmp(page[p], data + p*MMAP_PAGE_SIZE, MMAP_PAGE_SIZE)==0);
+	}
+
+	/* Mappings see writes, and survive closing and unlinking */
+	ASSERT(Seek(fid, 10, SEEK_FROM_START)==10);
+	ASSERT(Write(fid, "xyz", 3)==3);
+	ASSERT(memcmp(page[0]+10, "xyz", 3)==0);
+	Close(fid);
+	ASSERT(Open("/mapped", OPEN_WRITE|OPEN_TRUNC)==NOFILE);
+	ASSERT(Unlink("/mapped")==0);
+	ASSERT(page[2][5] == data[2*MMAP_PAGE_SIZE+5]);
+	for(int p=0; p<3; p++)
+		ASSERT(MUnmap(page[p])==0);
+	ASSERT(MUnmap(page[0])==-1);
+
+	/* Map a block of a disk */
+	ASSERT(GetBlockDevices() >= 1);
+	fid = OpenBlockDevice(0);
+	ASSERT(fid != NOFILE);
+	static char block[MMAP_PAGE_SIZE];
+	ASSERT(Seek(fid, 0, SEEK_FROM_START)==-1);
+	ASSERT(Read(fid, block, sizeof(block))==sizeof(block));
+	char* mb = MMap(fid, 512, 1024);
+	ASSERT(mb != NULL);
+
+	/* A mapped block that is written is still written back */
+	char* mb1 = MMap(fid, MMAP_PAGE_SIZE, 512);
+	ASSERT(mb1 != NULL);
+	ASSERT(Write(fid, block, 512)==512);
+	ASSERT(memcmp(mb1, block, 512)==0);
+	Close(fid);
+	ASSERT(memcmp(mb, block+512, 1024)==0);
+
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	bcache_info info = get_bcache_info(0);
+	for(int i=0; i<20 && info.dirty > 0; i++) {
+		Cond_TimedWait(&mx, &cv, 50);
+		info = get_bcache_info(0);
+	}
+	Mutex_Unlock(&mx);
+	ASSERT(info.dirty == 0);
+	ASSERT(MUnmap(mb1)==0);
+
+	/* The last mapping is released at exit */
+	return 0;
+}
+
+
+static io_stats get_fid_stats(Fid_t fid)
+{
+	fid_info info;
+	Fid_t finfo = OpenSysInfo(SYSINFO_FILES);
+	ASSERT(finfo != NOFILE);
+	do {
+		ASSERT(Read(finfo, (char*)&info, sizeof(info))==sizeof(info));
+	} while(info.fid != fid);
+	Close(finfo);
+	return info.stats;
+}
+
+static int delayed_writer(int argl, void* args)
+{
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	Cond_TimedWait(&mx, &cv, 20);
+	Mutex_Unlock(&mx);
+	return Write(argl, "hello", 5);
+}
+
+BOOT_TEST(test_io_stats,
+	"Test that streams and devices count their calls, bytes and blocking waits."
+	)
+{
+	/* A reader blocks on the pipe until the writer writes */
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Tid_t t = CreateThread(delayed_writer, pipe.write, NULL);
+	char buf[16];
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==5);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	io_stats st = get_fid_stats(pipe.read);
+	ASSERT(st.reads == 1 && st.bytes_read == 5 && st.writes == 0);
+	ASSERT(st.waits >= 1);
+	ASSERT(st.wait_ns >= 10000000);
+	st = get_fid_stats(pipe.write);
+	ASSERT(st.writes == 1 && st.bytes_written == 5);
+
+	/* Device statistics add up the streams of the device */
+	io_stats before, after;
+	ASSERT(DeviceStats(DEVICE_NULL, 0, &before)==0);
+	Fid_t n1 = OpenNull(), n2 = OpenNull();
+	ASSERT(Read(n1, buf, 10)==10);
+	ASSERT(Write(n2, buf, 7)==7);
+	ASSERT(Write(n2, buf, 3)==3);
+	ASSERT(DeviceStats(DEVICE_NULL, 0, &after)==0);
+	ASSERT(after.reads - before.reads == 1 && after.bytes_read - before.bytes_read == 10);
+	ASSERT(after.writes - before.writes == 2 && after.bytes_written - before.bytes_written == 10);
+	st = get_fid_stats(n2);
+	ASSERT(st.writes == 2 && st.reads == 0);
+
+	ASSERT(DeviceStats(DEVICE_NULL, 1, &after)==-1);
+	ASSERT(DeviceStats(DEVICE_BLOCK, MAX_DISKS, &after)==-1);
+	ASSERT(DeviceStats(-1, 0, &after)==-1);
+	return 0;
+}
+
+
+static int info_child(int argl, void* args)
+{
+	char c;
+	Read(0, &c, 1);		/* Wait for the parent to close the pipe */
+	return 0;
+}
+
+BOOT_TEST(test_open_info,
+	"Test that OpenInfo returns a record for each used PCB, many records per Read."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Dup2(pipe.read, 0);
+	Close(pipe.read);
+
+	const int N = 40;
+	Pid_t child[N];
+	for(int i=0; i<N; i++) {
+		child[i] = Exec(info_child, sizeof(i), &i);
+		ASSERT(child[i] != NOPROC);
+	}
+
+	/* Read all the records at once */
+	static procinfo info[MAX_PROC];
+	Fid_t finfo = OpenInfo();
+	ASSERT(finfo != NOFILE);
+	char small[sizeof(procinfo)-1];
+	ASSERT(Read(finfo, small, sizeof(small))==-1);
+	int n = Read(finfo, (char*)info, sizeof(info));
+	ASSERT(n % sizeof(procinfo) == 0);
+	n /= sizeof(procinfo);
+	ASSERT(n >= N+2);
+	ASSERT(Read(finfo, (char*)info, sizeof(info))==0);
+	Close(finfo);
+
+	int found = 0;
+	for(int k=0; k<n; k++) {
+		if(info[k].pid == GetPid()) {
+			ASSERT(info[k].alive && info[k].thread_count == 1);
+		}
+		for(int i=0; i<N; i++)
+			if(info[k].pid == child[i]) {
+				ASSERT(info[k].ppid == GetPid());
+				ASSERT(info[k].main_task == info_child);
+				ASSERT(info[k].argl == sizeof(int));
+				ASSERT(*(int*)info[k].args == i);
+				found++;
+			}
+	}
+	ASSERT(found == N);
+
+	/* Read one record at a time, while the children exit */
+	finfo = OpenInfo();
+	Close(pipe.write);
+	int m = 0;
+	procinfo one;
+	while(Read(finfo, (char*)&one, sizeof(one)) == sizeof(one)) m++;
+	ASSERT(m > 0);
+	Close(finfo);
+
+	for(int i=0; i<N; i++)
+		ASSERT(WaitChild(child[i], NULL)==child[i]);
+	return 0;
+}
+
+
+static int io_child(int argl, void* args)
+{
+	char buf[10];
+	Fid_t n = OpenNull();
+	Write(n, buf, 7);
+	Write(n, buf, 7);
+	Read(n, buf, 10);
+	return 0;
+}
+
+static int find_procinfo(Pid_t pid, procinfo* out)
+{
+	Fid_t finfo = OpenInfo();
+	ASSERT(finfo != NOFILE);
+	int found = 0;
+	while(!found && Read(finfo, (char*)out, sizeof(procinfo)) == sizeof(procinfo))
+		found = (out->pid == pid);
+	Close(finfo);
+	return found;
+}
+
+BOOT_TEST(test_procinfo_io,
+	"Test that procinfo records report the I/O totals of each process."
+	)
+{
+	Pid_t pid = Exec(io_child, 0, NULL);
+	ASSERT(pid != NOPROC);
+
+	/* Wait for the child to become a zombie, without reaping it */
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	procinfo info;
+	Mutex_Lock(&mx);
+	while(find_procinfo(pid, &info) && info.alive)
+		Cond_TimedWait(&mx, &cv, 1);
+	Mutex_Unlock(&mx);
+
+	ASSERT(find_procinfo(pid, &info));
+	ASSERT(info.io.reads == 1 && info.io.bytes_read == 10);
+	ASSERT(info.io.writes == 2 && info.io.bytes_written == 14);
+	ASSERT(info.io.waits == 0);
+
+	/* Our own reads of the info streams are counted too */
+	ASSERT(find_procinfo(GetPid(), &info));
+	ASSERT(info.io.reads > 0 && info.io.writes == 0);
+
+	ASSERT(WaitChild(pid, NULL)==pid);
+	return 0;
+}
+
+
+static void* execmany_seen[64];
+
+static int execmany_child(int argl, void* args)
+{
+	int* a = args;
+	execmany_seen[GetPid() % 64] = args;
+	return a[0];
+}
+
+BOOT_TEST(test_exec_many,
+	"Test that ExecMany creates many processes, sharing equal arguments."
+	)
+{
+	ASSERT(ExecMany(NULL, 4, 0, NULL, NULL)==-1);
+	ASSERT(ExecMany(execmany_child, 0, 0, NULL, NULL)==0);
+
+	/* Processes 0-3 share their arguments, 4-7 get their own */
+	int shared[2] = { 100, 0 };
+	int own[4][2];
+	void* argv[8];
+	Pid_t pids[8];
+	for(int i=0; i<4; i++) argv[i] = shared;
+	for(int i=0; i<4; i++) {
+		own[i][0] = 104+i;
+		own[i][1] = 4+i;
+		argv[4+i] = own[i];
+	}
+
+	ASSERT(ExecMany(execmany_child, 8, sizeof(shared), argv, pids)==8);
+	for(int i=0; i<8; i++) {
+		ASSERT(pids[i] != NOPROC);
+		for(int j=0; j<i; j++) ASSERT(pids[i] != pids[j]);
+	}
+
+	for(int i=0; i<8; i++) {
+		int exitval;
+		ASSERT(WaitChild(pids[i], &exitval)==pids[i]);
+		ASSERT(exitval == (i<4 ? 100 : 100+i));
+	}
+
+	/* Each process got a copy, and the first four share one */
+	void* seen[8];
+	for(int i=0; i<8; i++) {
+		seen[i] = execmany_seen[pids[i] % 64];
+		ASSERT(seen[i] != NULL && seen[i] != argv[i]);
+	}
+	for(int i=1; i<4; i++) ASSERT(seen[i] == seen[0]);
+	for(int i=4; i<8; i++)
+		for(int j=0; j<i; j++) ASSERT(seen[i] != seen[j]);
+	return 0;
+}
+
+
+static int tid_table_thread(int argl, void* args)
+{
+	return argl;
+}
+
+BOOT_TEST(test_thread_handles,
+	"Test that thread ids are validated, and that a stale tid never refers to a new thread."
+	)
+{
+	ASSERT(ThreadJoin(NOTHREAD, NULL)==-1);
+	ASSERT(ThreadJoin((Tid_t)12345, NULL)==-1);
+	ASSERT(ThreadDetach((Tid_t)-1)==-1);
+
+	/* Grow the table well past its initial size */
+	Tid_t tids[40];
+	for(int i=0; i<40; i++) {
+		tids[i] = CreateThread(tid_table_thread, i, NULL);
+		ASSERT(tids[i] != NOTHREAD && tids[i] != ThreadSelf());
+		for(int j=0; j<i; j++) ASSERT(tids[i] != tids[j]);
+	}
+	for(int i=0; i<40; i++) {
+		int exitval;
+		ASSERT(ThreadJoin(tids[i], &exitval)==0);
+		ASSERT(exitval == i);
+	}
+
+	/* A joined tid is stale, even when its slot is reused */
+	ASSERT(ThreadJoin(tids[0], NULL)==-1);
+	Tid_t t = CreateThread(tid_table_thread, 7, NULL);
+	for(int i=0; i<40; i++) ASSERT(t != tids[i]);
+	ASSERT(ThreadJoin(tids[39], NULL)==-1);
+	ASSERT(ThreadDetach(tids[39])==-1);
+	int exitval;
+	ASSERT(ThreadJoin(t, &exitval)==0 && exitval==7);
+	ASSERT(ThreadJoin(t, NULL)==-1);
+	return 0;
+}
+
+static int recycle_thread(int argl, void* args)
+{
+	/* Use some stack, so that a recycled block is dirty */
+	char buf[1024];
+	memset(buf, argl, sizeof(buf));
+	return buf[argl % sizeof(buf)] + argl;
+}
+
+BOOT_TEST(test_thread_recycle,
+	"Test that threads created in recycled thread blocks work, whether joined or detached."
+	)
+{
+	for(int round=0; round<50; round++) {
+		Tid_t tids[20];
+		for(int i=0; i<20; i++) {
+			tids[i] = CreateThread(recycle_thread, i, NULL);
+			ASSERT(tids[i] != NOTHREAD);
+		}
+		/* Detach a few, join the rest */
+		for(int i=0; i<20; i+=5) ASSERT(ThreadDetach(tids[i])==0);
+		for(int i=0; i<20; i++) {
+			if(i%5==0) continue;
+			int exitval;
+			ASSERT(ThreadJoin(tids[i], &exitval)==0);
+			ASSERT(exitval == 2*i);
+		}
+	}
+	return 0;
+}
+
+static int tls_thread(int argl, void* args)
+{
+	int key = *(int*)args;
+	if(TlsGet(key) != NULL) return -1;
+	if(TlsSet(key, &argl) != 0) return -1;
+	for(int i=0; i<100; i++) {
+		ThreadSelf();  /* enter the kernel, to allow other threads to run */
+		if(TlsGet(key) != &argl) return -1;
+	}
+	return argl;
+}
+
+BOOT_TEST(test_tls,
+	"Test that thread-local storage slots are private to each thread."
+	)
+{
+	ASSERT(TlsGet(0)==NULL);
+	ASSERT(TlsSet(0, &argl)==-1);
+	ASSERT(TlsSet(MAX_TLS_KEYS, &argl)==-1);
+	ASSERT(TlsFree(0)==-1);
+
+	int key = TlsAlloc();
+	ASSERT(key != NOTLSKEY);
+	ASSERT(TlsGet(key)==NULL);
+	ASSERT(TlsSet(key, &key)==0);
+
+	Tid_t tids[8];
+	for(int i=0; i<8; i++)
+		tids[i] = CreateThread(tls_thread, i, &key);
+	for(int i=0; i<8; i++) {
+		int exitval;
+		ASSERT(ThreadJoin(tids[i], &exitval)==0);
+		ASSERT(exitval == i);
+	}
+	ASSERT(TlsGet(key)==&key);
+
+	/* A reallocated key starts out NULL */
+	ASSERT(TlsFree(key)==0);
+	ASSERT(TlsGet(key)==NULL);
+	ASSERT(TlsAlloc()==key);
+	ASSERT(TlsGet(key)==NULL);
+
+	/* The keys run out */
+	int n = 1;
+	while(TlsAlloc() != NOTLSKEY) n++;
+	ASSERT(n == MAX_TLS_KEYS);
+	return 0;
+}
+
+static int rusage_thread(int argl, void* args)
+{
+	return 0;
+}
+
+static int rusage_child(int argl, void* args)
+{
+	pipe_t p;
+	if(Pipe(&p)) return 1;
+	char buf[100] = { 0 };
+	if(Write(p.write, buf, 100) != 100) return 1;
+	if(Read(p.read, buf, 100) != 100) return 1;
+	Close(p.read); Close(p.write);
+
+	Tid_t t[3];
+	for(int i=0; i<3; i++) t[i] = CreateThread(rusage_thread, 0, NULL);
+	for(int i=0; i<3; i++) ThreadJoin(t[i], NULL);
+	return 0;
+}
+
+BOOT_TEST(test_rusage,
+	"Test that GetRUsage counts the I/O, pipes and threads of a process, and of its children."
+	)
+{
+	rusage_t ru;
+	ASSERT(GetRUsage(RUSAGE_SELF, NULL)==-1);
+	ASSERT(GetRUsage(MAX_PROC-1, &ru)==-1);
+
+	ASSERT(GetRUsage(RUSAGE_SELF, &ru)==0);
+	ASSERT(ru.threads == 1 && ru.peak_threads == 1);
+	ASSERT(ru.pipes == 0 && ru.reads == 0 && ru.writes == 0);
+
+	ASSERT(GetRUsage(RUSAGE_CHILDREN, &ru)==0);
+	ASSERT(ru.threads == 0 && ru.cpu_ns == 0);
+
+	Pid_t pid = Exec(rusage_child, 0, NULL);
+	int exitval;
+	ASSERT(WaitChild(pid, &exitval)==pid && exitval==0);
+	ASSERT(GetRUsage(pid, &ru)==-1);
+
+	ASSERT(GetRUsage(RUSAGE_CHILDREN, &ru)==0);
+	ASSERT(ru.pipes == 1);
+	ASSERT(ru.reads == 1 && ru.bytes_read == 100);
+	ASSERT(ru.writes == 1 && ru.bytes_written == 100);
+	ASSERT(ru.threads == 4 && ru.peak_threads >= 2 && ru.peak_threads <= 4);
+	ASSERT(ru.cpu_ns > 0);
+
+	/* The caller has used some CPU time too */
+	ASSERT(GetRUsage(GetPid(), &ru)==0);
+	ASSERT(ru.cpu_ns > 0 && ru.threads == 1);
+	return 0;
+}
+
+
+static volatile int rusage_spin_done;
+
+static int rusage_spinner(int argl, void* args)
+{
+	while(! rusage_spin_done);
+	return 0;
+}
+
+BOOT_TEST(test_rusage_running,
+	"Test that GetRUsage on another process counts the time slices its threads "
+	"are running on other cores, and that exiting threads are charged in full.",
+	.minimum_cores = 2
+	)
+{
+	rusage_spin_done = 0;
+	Pid_t pid = Exec(rusage_spinner, 0, NULL);
+	ASSERT(pid != NOPROC);
+
+	/* The spinner keeps its core, without a context switch */
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	Cond_TimedWait(&mx, &cv, 100);
+	Mutex_Unlock(&mx);
+
+	rusage_t ru;
+	ASSERT(GetRUsage(pid, &ru)==0);
+	ASSERT(ru.cpu_ns >= 50000000);
+	uint64_t spun = ru.cpu_ns;
+
+	rusage_spin_done = 1;
+	ASSERT(WaitChild(pid, NULL)==pid);
+	ASSERT(GetRUsage(RUSAGE_CHILDREN, &ru)==0);
+	ASSERT(ru.cpu_ns >= spun);
+	ASSERT(ru.vol_switches >= 1);
+	return 0;
+}
+
+static int vdso_thread(int argl, void* args)
+{
+	const vdso_page* v = GetVDSO();
+	return v == args || v->tid != ThreadSelf() || v->pid != GetPid();
+}
+
+BOOT_TEST(test_vdso,
+	"Test that the page shared with each thread holds its pid and tid, and a clock."
+	)
+{
+	const vdso_page* v = GetVDSO();
+	ASSERT(v != NULL);
+	ASSERT(v->pid == GetPid());
+	ASSERT(v->tid == ThreadSelf() && v->tid != NOTHREAD);
+
+	uint64_t t0 = v->clock_ns();
+	uint64_t t1 = v->clock_ns();
+	ASSERT(t0 > 0 && t1 >= t0);
+
+	Tid_t t = CreateThread(vdso_thread, 0, (void*)v);
+	int exitval;
+	ASSERT(ThreadJoin(t, &exitval)==0 && exitval==0);
+
+	Pid_t pid = Exec(vdso_thread, 0, (void*)v);
+	ASSERT(WaitChild(pid, &exitval)==pid && exitval==0);
+	return 0;
+}
+
+BOOT_TEST(test_syscall_profile,
+	"Test that the syscall profile is available exactly when the kernel is built with SYSCALL_PROFILE."
+	)
+{
+	Fid_t fid = OpenSysInfo(SYSINFO_SYSCALLS);
+#ifndef SYSCALL_PROFILE
+	ASSERT(fid == NOFILE);
+#else
+	ASSERT(fid != NOFILE);
+	int found = 0;
+	syscall_info info;
+	while(Read(fid, (char*) &info, sizeof(info)) == sizeof(info)) {
+		unsigned long n = 0, m = 0;
+		for(int b=0; b<SYSCALL_HIST_BUCKETS; b++) {
+			n += info.body_hist[b];
+			m += info.lock_hist[b];
+		}
+		ASSERT(n == info.calls);
+		ASSERT(m == (info.locked ? info.calls : 0));
+		if(strcmp(info.name, "OpenSysInfo")==0) {
+			/* This call is recorded after it returns */
+			ASSERT(info.locked && info.calls == 0);
+			found++;
+		}
+		if(strcmp(info.name, "GetPid")==0) ASSERT(! info.locked);
+	}
+	ASSERT(found == 1);
+	ASSERT(Close(fid)==0);
+#endif
+	return 0;
+}
+
+BOOT_TEST(test_syscall_batch,
+	"Test that SyscallBatch executes a vector of system calls, and stops on error when asked."
+	)
+{
+	ASSERT(SyscallBatch(NULL, 1, 0)==-1);
+	ASSERT(SyscallBatch(NULL, 0, 0)==-1);
+
+	pipe_t p;
+	char out[] = "batch", in[8] = { 0 };
+	Fid_t null = OpenNull();
+	ASSERT(null != NOFILE);
+	batch_op ops[] = {
+		{ .opcode=BATCH_PIPE, .buf=&p },
+		{ .opcode=BATCH_DUP2, .fid=null, .newfid=MAX_FILEID-1 },
+		{ .opcode=BATCH_CLOSE, .fid=MAX_FILEID-1 },
+		{ .opcode=BATCH_CLOSE, .fid=null }
+	};
+	ASSERT(SyscallBatch(ops, 4, BATCH_STOP_ON_ERROR)==4);
+	for(int i=0; i<4; i++) ASSERT(ops[i].result==0);
+
+	/* The fids of the pipe are known now */
+	batch_op io[] = {
+		{ .opcode=BATCH_WRITE, .fid=p.write, .buf=out, .size=5 },
+		{ .opcode=BATCH_CLOSE, .fid=p.write },
+		{ .opcode=BATCH_READ, .fid=p.read, .buf=in, .size=sizeof(in) },
+		{ .opcode=BATCH_READ, .fid=p.read, .buf=in, .size=sizeof(in) },
+		{ .opcode=BATCH_CLOSE, .fid=p.read },
+		{ .opcode=BATCH_CLOSE, .fid=p.read },
+		{ .opcode=42 },
+		{ .opcode=BATCH_CLOSE, .fid=MAX_FILEID }
+	};
+	ASSERT(SyscallBatch(io, 8, 0)==8);
+	ASSERT(io[0].result==5 && io[1].result==0);
+	ASSERT(io[2].result==5 && memcmp(in, out, 5)==0);
+	ASSERT(io[3].result==0);
+	ASSERT(io[4].result==0 && io[5].result==0);  /* closing a closed fid is legal */
+	ASSERT(io[6].result==-1 && io[7].result==-1);
+
+	/* Stop at the first error */
+	batch_op stop[] = {
+		{ .opcode=BATCH_CLOSE, .fid=-1 },
+		{ .opcode=BATCH_PIPE, .buf=&p },
+	};
+	stop[1].result = 1234;
+	ASSERT(SyscallBatch(stop, 2, BATCH_STOP_ON_ERROR)==1);
+	ASSERT(stop[0].result==-1 && stop[1].result==1234);
+	return 0;
+}
+
+static int futex_word;
+static int futex_waiters;
+
+static int futex_waiter_thread(int argl, void* args)
+{
+	__atomic_add_fetch(&futex_waiters, 1, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(&futex_word, __ATOMIC_SEQ_CST) == 0)
+		FutexWait(&futex_word, 0, FUTEX_NO_TIMEOUT);
+	return 0;
+}
+
+BOOT_TEST(test_futex,
+	"Test that FutexWait sleeps only while the futex has the expected value, and FutexWake wakes it."
+	)
+{
+	int word = 1;
+	ASSERT(FutexWait(NULL, 0, 10)==-1);
+	ASSERT(FutexWake(NULL, 1)==-1);
+	ASSERT(FutexWait(&word, 0, FUTEX_NO_TIMEOUT)==-1);
+	ASSERT(FutexWake(&word, 5)==0);
+
+	/* A timeout */
+	const vdso_page* v = GetVDSO();
+	uint64_t t0 = v->clock_ns();
+	ASSERT(FutexWait(&word, 1, 50)==-1);
+	ASSERT(v->clock_ns() - t0 >= 40000000ull);
+
+	/* Wake up waiting threads */
+	futex_word = 0;
+	futex_waiters = 0;
+	Tid_t tids[5];
+	for(int i=0; i<5; i++)
+		tids[i] = CreateThread(futex_waiter_thread, 0, NULL);
+	while(__atomic_load_n(&futex_waiters, __ATOMIC_SEQ_CST) < 5)
+		FutexWait(&word, 1, 1);
+
+	__atomic_store_n(&futex_word, 1, __ATOMIC_SEQ_CST);
+	int woken = 0;
+	for(int i=0; i<5; i++) {
+		woken += FutexWake(&futex_word, 1);
+		ASSERT(woken <= 5);
+	}
+	woken += FutexWake(&futex_word, 100);
+	ASSERT(woken <= 5);
+	for(int i=0; i<5; i++)
+		ASSERT(ThreadJoin(tids[i], NULL)==0);
+	ASSERT(FutexWake(&futex_word, 100)==0);
+	return 0;
+}
+
+BOOT_TEST(test_deferred_work,
+	"Test that device interrupts are completed by the deferred work of the cores, "
+	"and that its statistics are consistent."
+	)
+{
+	ASSERT(GetBlockDevices() >= 1);
+	Fid_t fid = OpenBlockDevice(0);
+	ASSERT(fid != NOFILE);
+	static char block[4096];
+	for(int i=0; i<8; i++)
+		ASSERT(Read(fid, block, sizeof(block))==sizeof(block));
+	Close(fid);
+
+	Fid_t info_fid = OpenSysInfo(SYSINFO_DEFER);
+	ASSERT(info_fid != NOFILE);
+	defer_info info;
+	unsigned int cores = 0;
+	unsigned long runs = 0;
+	while(Read(info_fid, (char*) &info, sizeof(info)) == sizeof(info)) {
+		ASSERT(info.core == cores);
+		ASSERT(info.runs <= info.queued);
+		ASSERT(info.queued - info.runs == info.depth);
+		ASSERT(info.depth <= info.max_depth);
+		ASSERT(info.wakeups <= info.queued);
+		ASSERT(info.latency_ns <= info.runs * info.max_latency_ns);
+		runs += info.runs;
+		cores++;
+	}
+	ASSERT(cores >= 1);
+	ASSERT(runs > 0);
+	ASSERT(Close(info_fid)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_serial_tx_ring,
+	"Test that console output is sent in order through the output ring of the terminal, "
+	"and that small writes do not block.",
+	.minimum_terminals = 1
+	)
+{
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+
+	/* More than the ring can hold */
+	static char text[10000];
+	for(int i=0; i<9999; i++)
+		text[i] = 'a' + i%26;
+	text[9999] = '\0';
+	expect(0, text);
+
+	ASSERT(Write(fterm, text, 100)==100);
+	for(int count=100; count < 9999; ) {
+		int rc = Write(fterm, text+count, 9999-count);
+		ASSERT(rc>0);
+		count += rc;
+	}
+
+	/* This waits for the ring to drain */
+	ASSERT(Close(fterm)==0);
+	return 0;
+}
+
+
+static volatile int tx_race_done;
+
+static int tx_race_closer(int argl, void* args)
+{
+	while(! tx_race_done) {
+		Fid_t fid = OpenTerminal(0);
+		ASSERT(fid != NOFILE);
+		ASSERT(Close(fid)==0);
+	}
+	return 0;
+}
+
+BOOT_TEST(test_serial_tx_close_race,
+	"Test that closing a terminal while another stream writes to it does not "
+	"miss the draining of the output ring.",
+	.minimum_terminals = 1
+	)
+{
+	static char text[20000];
+	for(int i=0; i<sizeof(text)-1; i++)
+		text[i] = 'a' + i%26;
+	text[sizeof(text)-1] = '\0';
+	expect(0, text);
+
+	tx_race_done = 0;
+	Tid_t closers[2];
+	for(int i=0; i<2; i++)
+		closers[i] = CreateThread(tx_race_closer, 0, NULL);
+
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+	for(int count=0; count < sizeof(text)-1; ) {
+		/* Small writes, so that the ring is often drained by the writer */
+		int len = sizeof(text)-1-count;
+		if(len > 37) len = 37;
+		int rc = Write(fterm, text+count, len);
+		ASSERT(rc>0);
+		count += rc;
+	}
+	ASSERT(Close(fterm)==0);
+
+	tx_race_done = 1;
+	for(int i=0; i<2; i++)
+		ASSERT(ThreadJoin(closers[i], NULL)==0);
+	return 0;
+}
+
+
+static char tx_wait_text[100000];
+static volatile int tx_wait_expected;
+
+/* The console is not read until the expect */
+static int delayed_expect(int argl, void* args)
+{
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	Cond_TimedWait(&mx, &cv, 50);
+	Mutex_Unlock(&mx);
+	tx_wait_expected = 1;
+	expect(0, tx_wait_text);
+	return 0;
+}
+
+static int tx_wait_writer(int argl, void* args)
+{
+	for(int count=0; count < sizeof(tx_wait_text)-1; ) {
+		int rc = Write(argl, tx_wait_text+count, sizeof(tx_wait_text)-1-count);
+		ASSERT(rc>0);
+		count += rc;
+	}
+	return 0;
+}
+
+BOOT_TEST(test_serial_tx_wait_stats,
+	"Test that a writer that blocks on a full output ring is counted as a blocking wait.",
+	.minimum_terminals = 1
+	)
+{
+	for(int i=0; i<sizeof(tx_wait_text)-1; i++)
+		tx_wait_text[i] = 'a' + i%26;
+	tx_wait_text[sizeof(tx_wait_text)-1] = '\0';
+
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+	tx_wait_expected = 0;
+	Tid_t t = CreateThread(delayed_expect, 0, NULL);
+	ASSERT(tx_wait_writer(fterm, NULL)==0);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	io_stats st = get_fid_stats(fterm);
+	ASSERT(st.bytes_written == sizeof(tx_wait_text)-1);
+	ASSERT(st.waits >= 1);
+	ASSERT(st.wait_ns >= 10000000);
+	ASSERT(Close(fterm)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_serial_close_own_output,
+	"Test that closing a terminal stream waits only for the output of that stream, "
+	"and not for the output of other streams.",
+	.minimum_terminals = 1
+	)
+{
+	for(int i=0; i<sizeof(tx_wait_text)-1; i++)
+		tx_wait_text[i] = 'a' + i%26;
+	tx_wait_text[sizeof(tx_wait_text)-1] = '\0';
+
+	/* The writer fills the ring, which is not drained until the expect */
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+	tx_wait_expected = 0;
+	Tid_t writer = CreateThread(tx_wait_writer, fterm, NULL);
+	Tid_t t = CreateThread(delayed_expect, 0, NULL);
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	Cond_TimedWait(&mx, &cv, 20);
+	Mutex_Unlock(&mx);
+
+	/* A stream that wrote nothing closes at once */
+	Fid_t fother = OpenTerminal(0);
+	ASSERT(fother!=NOFILE);
+	ASSERT(Close(fother)==0);
+	ASSERT(! tx_wait_expected);
+
+	ASSERT(ThreadJoin(writer, NULL)==0);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	ASSERT(Close(fterm)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_term_canonical,
+	"Test the canonical mode of the terminal line discipline: reading whole lines, "
+	"line editing, end-of-file and echo.",
+	.minimum_terminals = 1
+	)
+{
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+	Fid_t fnull = OpenNull();
+	ASSERT(TermMode(fnull, -1) == -1);
+	Close(fnull);
+
+	ASSERT(TermMode(fterm, -1) == TERM_RAW);
+	ASSERT(TermMode(fterm, 7) == -1);
+	ASSERT(TermMode(fterm, TERM_CANON|TERM_ECHO) == TERM_RAW);
+
+	expect(0, "hellp\b \bo\nab\b \b\b \bxy\nlast");
+	sendme(0, "hellp\bo\nab\x15xy\rlast\x04\x04");
+
+	char buf[64];
+	ASSERT(Read(fterm, buf, sizeof(buf)) == 6);
+	ASSERT(memcmp(buf, "hello\n", 6) == 0);
+	ASSERT(Read(fterm, buf, sizeof(buf)) == 3);
+	ASSERT(memcmp(buf, "xy\n", 3) == 0);
+	ASSERT(Read(fterm, buf, sizeof(buf)) == 4);
+	ASSERT(memcmp(buf, "last", 4) == 0);
+	ASSERT(Read(fterm, buf, sizeof(buf)) == 0);
+
+	/* The unfinished line becomes readable in raw mode */
+	ASSERT(TermMode(fterm, TERM_CANON) == (TERM_CANON|TERM_ECHO));
+	sendme(0, "ab");
+	ASSERT(TermMode(fterm, TERM_RAW) == TERM_CANON);
+	checked_read(fterm, "ab");
+
+	ASSERT(Close(fterm)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_serial_echo_close_race,
+	"Test that closing a terminal while it echoes its input does not miss the "
+	"draining of the output ring.",
+	.minimum_terminals = 1
+	)
+{
+	static char text[4000];
+	for(int i=0; i<sizeof(text)-1; i++)
+		text[i] = 'a' + i%26;
+	text[sizeof(text)-1] = '\0';
+
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+	ASSERT(TermMode(fterm, TERM_ECHO) == TERM_RAW);
+
+	tx_race_done = 0;
+	Tid_t closers[2];
+	for(int i=0; i<2; i++)
+		closers[i] = CreateThread(tx_race_closer, 0, NULL);
+
+	expect(0, text);
+	sendme(0, text);
+	checked_read(fterm, text);
+
+	ASSERT(TermMode(fterm, TERM_RAW) == TERM_ECHO);
+	ASSERT(Close(fterm)==0);
+
+	tx_race_done = 1;
+	for(int i=0; i<2; i++)
+		ASSERT(ThreadJoin(closers[i], NULL)==0);
+	return 0;
+}
+
+
+static int delayed_sender(int argl, void* args)
+{
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	Cond_TimedWait(&mx, &cv, 20);
+	Mutex_Unlock(&mx);
+	sendme(0, "late\n");
+	return 0;
+}
+
+BOOT_TEST(test_term_read_stats,
+	"Test that a terminal read that blocks is counted as a blocking wait.",
+	.minimum_terminals = 1
+	)
+{
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+	ASSERT(TermMode(fterm, TERM_CANON) == TERM_RAW);
+
+	io_stats before, after;
+	ASSERT(DeviceStats(DEVICE_TERMINAL, 0, &before)==0);
+	Tid_t t = CreateThread(delayed_sender, 0, NULL);
+	checked_read(fterm, "late\n");
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	io_stats st = get_fid_stats(fterm);
+	ASSERT(st.reads == 1 && st.bytes_read == 5);
+	ASSERT(st.waits >= 1);
+	ASSERT(st.wait_ns >= 10000000);
+	ASSERT(DeviceStats(DEVICE_TERMINAL, 0, &after)==0);
+	ASSERT(after.waits > before.waits);
+	ASSERT(Close(fterm)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_serial_routing,
+	"Test that the interrupts of the terminals are spread over the cores, "
+	"and that the routing table is consistent.",
+	.minimum_terminals = 1
+	)
+{
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+	sendme(0, "route");
+	checked_read(fterm, "route");
+	Close(fterm);
+
+	serial_route_info info[MAX_TERMINALS];
+	unsigned long irqs[MAX_TERMINALS];
+	for(int pass=0; pass<2; pass++) {
+		Fid_t info_fid = OpenSysInfo(SYSINFO_SERIAL);
+		ASSERT(info_fid != NOFILE);
+		unsigned int terms = 0;
+		while(Read(info_fid, (char*) &info[terms], sizeof(info[0])) == sizeof(info[0])) {
+			serial_route_info* r = &info[terms];
+			ASSERT(r->term == terms);
+			ASSERT(r->core < cpu_cores());
+			/* Terminals that were never moved keep their boot routing */
+			if(r->moves == 0)
+				ASSERT(r->core == r->term % cpu_cores());
+			/* The counters never decrease */
+			if(pass > 0)
+				ASSERT(r->rx_interrupts + r->tx_interrupts >= irqs[terms]);
+			irqs[terms] = r->rx_interrupts + r->tx_interrupts;
+			terms++;
+		}
+		ASSERT(terms == GetTerminalDevices());
+		ASSERT(Close(info_fid)==0);
+	}
+	return 0;
+}
+
+
 TEST_SUITE(user_tests, 
 	"These are tests defined by the user."
 	)
 {
 	&dummy_user_test,
+	&test_async_ring,
+	&test_async_submitter_exit,
+	&test_shm_ring,
+	&test_block_device,
+	&test_buffer_cache,
+	&test_ramfs,
+	&test_mmap,
+	&test_io_stats,
+	&test_open_info,
+	&test_procinfo_io,
+	&test_exec_many,
+	&test_thread_handles,
+	&test_thread_recycle,
+	&test_tls,
+	&test_rusage,
+	&test_rusage_running,
+	&test_vdso,
+	&test_syscall_profile,
+	&test_syscall_batch,
+	&test_futex,
+	&test_deferred_work,
+	&test_serial_tx_ring,
+	&test_serial_tx_close_race,
+	&test_serial_tx_wait_stats,
+	&test_serial_close_own_output,
+	&test_term_canonical,
+	&test_serial_echo_close_race,
+	&test_term_read_stats,
+	&test_serial_routing,
 	NULL
 };
 